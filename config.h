@@ -1,9 +1,36 @@
 #ifndef CONFIG_H
 #define CONFIG_H
 
-// Choose whether to use KISS or direct
-// framing for serial data
+// Choose whether to use KISS, direct or
+// length-prefixed binary framing for
+// serial data
 #define SERIAL_FRAMING SERIAL_FRAMING_KISS
 //#define SERIAL_FRAMING SERIAL_FRAMING_DIRECT
+//#define SERIAL_FRAMING SERIAL_FRAMING_BINARY
+
+// Choose which demodulator to use for received
+// audio. The discriminator is cheap and works
+// well on flat audio, the correlator costs more
+// cycles but copes much better with radios that
+// have de-emphasis twist between the two tones
+#define AFSK_DEMODULATOR AFSK_DEMOD_DISCRIMINATOR
+//#define AFSK_DEMODULATOR AFSK_DEMOD_CORRELATOR
+
+// Choose the modulation. AFSK is 1200 baud Bell
+// 202 audio, which works through the speaker and
+// microphone of mostly any radio. G3RUH is
+// scrambled baseband FSK, which needs a radio
+// with a flat 9k6 data port, but is several
+// times faster. Both ends must use the same.
+// The host tests build the other one too, by
+// setting it on the command line.
+#ifndef MODULATION
+#define MODULATION MODULATION_AFSK
+//#define MODULATION MODULATION_G3RUH
+#endif
+
+// Bitrate G3RUH mode starts out with, 4800 or
+// 9600. It can be changed at runtime.
+#define G3RUH_BITRATE 9600
 
 #endif
\ No newline at end of file
@@ -14,8 +14,15 @@
 // OR
 //#define ADC_REFERENCE REF_5V
 
-// Sampling & timer setup
-#define CONFIG_AFSK_DAC_SAMPLERATE 9600
+// Sampling & timer setup. In G3RUH mode we take
+// four samples per bit at 9600 bps, and eight at
+// 4800 bps.
+#include "config.h"
+#if MODULATION == MODULATION_G3RUH
+    #define CONFIG_AFSK_DAC_SAMPLERATE 38400UL
+#else
+    #define CONFIG_AFSK_DAC_SAMPLERATE 9600
+#endif
 
 // Don't change this! Change it in
 // config.h instead. This is going away
@@ -35,6 +42,8 @@
     #define LED_DDR  DDRB
     #define ADC_PORT PORTC
     #define ADC_DDR  DDRC
+    #define TIMING_PIN PINB
+    #define TIMING_DDR DDRB
 #endif
 
 #endif
\ No newline at end of file
@@ -30,7 +30,7 @@ void AFSK_hw_init(void) {
 
     TCCR1A = 0;                                    
     TCCR1B = _BV(CS10) | _BV(WGM13) | _BV(WGM12);
-    ICR1 = (((CPU_FREQ+FREQUENCY_CORRECTION)) / 9600) - 1;
+    ICR1 = (((CPU_FREQ+FREQUENCY_CORRECTION)) / SAMPLERATE) - 1;
 
     if (hw_5v_ref) {
         ADMUX = _BV(REFS0) | 0;
@@ -53,24 +53,37 @@ void AFSK_hw_init(void) {
     AFSK_DAC_INIT();
     LED_TX_INIT();
     LED_RX_INIT();
+    #if CONFIG_AFSK_DAC_TIMING
+        DAC_TIMING_INIT();
+    #endif
 }
 
 void AFSK_init(Afsk *afsk) {
     // Allocate modem struct memory
     memset(afsk, 0, sizeof(*afsk));
     AFSK_modem = afsk;
-    // Set phase increment
-    afsk->phaseInc = MARK_INC;
-    afsk->silentSamples = 0;
+
+    // Start out with the input centered in the
+    // ADC range, and at unity gain
+    afsk->adcBias = ADC_BIAS_CENTER;
+    afsk->adcGain = AGC_GAIN_UNITY;
+    afsk->adcShift = 0;
+    afsk->adcScale = 1 << AGC_SCALE_FRAC;
+    afsk->biasEstimate = ADC_BIAS_CENTER << ADC_BIAS_FRAC;
 
     // Initialise FIFO buffers
-    fifo_init(&afsk->delayFifo, (uint8_t *)afsk->delayBuf, sizeof(afsk->delayBuf));
-    fifo_init(&afsk->rxFifo, afsk->rxBuf, sizeof(afsk->rxBuf));
+    fifo_init(&afsk->adcFifo, (uint8_t *)afsk->adcBuf, sizeof(afsk->adcBuf));
+    for (uint8_t i = 0; i < CONFIG_AFSK_SLICERS; i++) {
+        fifo_init(&afsk->slicers[i].rxFifo, afsk->slicers[i].rxBuf, sizeof(afsk->slicers[i].rxBuf));
+    }
     fifo_init(&afsk->txFifo, afsk->txBuf, sizeof(afsk->txBuf));
+    fifo_init(&afsk->txBitFifo, afsk->txBitBuf, sizeof(afsk->txBitBuf));
 
-    // Fill delay FIFO with zeroes
-    for (int i = 0; i<SAMPLESPERBIT / 2; i++) {
-        fifo_push(&afsk->delayFifo, 0);
+    // Start out with the configured bitrate, or
+    // the first profile if there is none for it
+    AFSK_setProfile(afsk, 0);
+    for (uint8_t i = 0; i < AFSK_PROFILES; i++) {
+        if (AFSK_profileBitrate(i) == CONFIG_AFSK_BITRATE) AFSK_setProfile(afsk, i);
     }
 
     AFSK_hw_init();
@@ -80,126 +93,428 @@ void AFSK_init(Afsk *afsk) {
     afsk->fd = afsk_fd;
 }
 
+// Loads a profile into the modem. Whatever the
+// demodulator was in the middle of is thrown
+// away, and it starts over with the new bitrate.
+// This must not happen while sending, since the
+// DAC ISR works from the profile.
+static void AFSK_loadProfile(Afsk *afsk, uint8_t index) {
+    memcpy_P(&afsk->profile, &afskProfiles[index], sizeof(AfskProfile));
+    afsk->profileIndex = index;
+
+    uint8_t samplesPerBit = afsk->profile.samplesPerBit;
+    afsk->pllPhaseStep = (int16_t)afsk->profile.phaseBits << PLL_FRAC_BITS;
+    afsk->pllPhaseMax = afsk->pllPhaseStep * samplesPerBit;
+    afsk->dcdTimeout = DCD_TIMEOUT_BITS * samplesPerBit;
+
+    // The slicers keep their received data, but
+    // everything before it is reset
+    for (uint8_t i = 0; i < CONFIG_AFSK_SLICERS; i++) {
+        memset(&afsk->slicers[i], 0, offsetof(AfskSlicer, rxFifo));
+    }
+
+    #if MODULATION == MODULATION_G3RUH
+        afsk->lastSample[0] = afsk->lastSample[1] = 0;
+    #else
+        afsk->phaseInc = afsk->profile.markInc;
+
+        // Fill delay FIFO with zeroes
+        fifo_init(&afsk->delayFifo, (uint8_t *)afsk->delayBuf, sizeof(afsk->delayBuf));
+        for (uint8_t i = 0; i < AFSK_DELAY_SAMPLES(samplesPerBit); i++) {
+            fifo_push(&afsk->delayFifo, 0);
+        }
+
+        afsk->bandX[0] = afsk->bandX[1] = 0;
+        afsk->bandY[0] = afsk->bandY[1] = 0;
+
+        #if AFSK_DEMODULATOR == AFSK_DEMOD_CORRELATOR
+            afsk->markPhase = afsk->spacePhase = 0;
+            afsk->markI = afsk->markQ = afsk->spaceI = afsk->spaceQ = 0;
+        #else
+            afsk->iirX[0] = afsk->iirX[1] = 0;
+            afsk->iirY[0] = afsk->iirY[1] = 0;
+        #endif
+    #endif
+}
+
+// Sets the profile the modem sends with, and
+// switches the demodulator over to it as well.
+// While the modem is sending, this is refused.
+bool AFSK_setProfile(Afsk *afsk, uint8_t index) {
+    if (index >= AFSK_PROFILES || afsk->sending) return false;
+
+    afsk->txProfile = index;
+    AFSK_loadProfile(afsk, index);
+    return true;
+}
+
+uint16_t AFSK_profileBitrate(uint8_t index) {
+    if (index >= AFSK_PROFILES) return 0;
+    return pgm_read_word(&afskProfiles[index].bitrate);
+}
+
 static void AFSK_txStart(Afsk *afsk) {
-    if (!afsk->sending) {
-        afsk->phaseInc = MARK_INC;
-        afsk->phaseAcc = 0;
-        afsk->bitstuffCount = 0;
-        afsk->sending = true;
-        afsk->sending_data = true;
-        LED_TX_ON();
-        afsk->preambleLength = DIV_ROUND(custom_preamble * BITRATE, 8000);
-        AFSK_DAC_IRQ_START();
+    // The demodulator may have followed someone
+    // sending at another bitrate, so we go back
+    // to our own profile before we start
+    if (!afsk->sending && afsk->profileIndex != afsk->txProfile) {
+        AFSK_loadProfile(afsk, afsk->txProfile);
     }
+
     ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
-      afsk->tailLength = DIV_ROUND(custom_tail * BITRATE, 8000);
+        if (!afsk->sending) {
+            #if MODULATION == MODULATION_AFSK
+                afsk->phaseInc = afsk->profile.markInc;
+                afsk->phaseAcc = 0;
+            #endif
+            afsk->txBitsLeft = 0;
+            afsk->bitStuff = false;
+            afsk->bitstuffCount = 0;
+            afsk->encodedBits = 0;
+            afsk->encodedCount = 0;
+            afsk->txDone = false;
+            afsk->txInFrame = false;
+            afsk->txUnderrun = false;
+            afsk->txDropping = false;
+            afsk->abortLength = 0;
+            fifo_flush(&afsk->txBitFifo);
+            afsk->sending = true;
+            LED_TX_ON();
+            afsk->preambleLength = DIV_ROUND(custom_preamble * afsk->profile.bitrate, 8000);
+            AFSK_DAC_IRQ_START();
+        } else {
+            // If the encoder had already finished,
+            // but the ISR is still sending the last
+            // bits, we just carry on with the new data
+            afsk->txDone = false;
+        }
+    }
+    afsk->tailLength = DIV_ROUND(custom_tail * afsk->profile.bitrate, 8000);
+}
+
+static void AFSK_putBit(Afsk *afsk, uint8_t toggle) {
+    #if MODULATION == MODULATION_G3RUH
+        // In G3RUH mode the NRZI level is scrambled
+        // here, and the bit FIFO carries line levels
+        // instead of tone switches
+        afsk->nrziLevel ^= toggle;
+        toggle = g3ruh_scramble(&afsk->scrambler, afsk->nrziLevel);
+    #endif
+    afsk->encodedBits |= (uint16_t)toggle << afsk->encodedCount;
+    if (++afsk->encodedCount == 8) {
+        fifo_push(&afsk->txBitFifo, afsk->encodedBits);
+        afsk->encodedBits = 0;
+        afsk->encodedCount = 0;
+    }
+}
+
+// Encodes one byte into tone bits, LSB first.
+// A 0 is sent by switching tone and a 1 by
+// keeping the current tone (NRZI), and when
+// bitstuffing is allowed, a 0 is inserted after
+// every five consecutive 1's. Flags and other
+// control bytes are sent without stuffing, and
+// only frame data is stuffed, so this is also
+// where we keep track of being inside a frame.
+static void AFSK_encodeByte(Afsk *afsk, uint8_t byte, bool stuff) {
+    afsk->txInFrame = stuff;
+    if (!stuff) {
+        afsk->bitStuff = false;
+    } else {
+        if (!afsk->bitStuff) afsk->bitstuffCount = 0;
+        afsk->bitStuff = true;
+    }
+
+    for (uint8_t i = 0; i < 8; i++) {
+        if (afsk->bitStuff && afsk->bitstuffCount >= BIT_STUFF_LEN) {
+            afsk->bitstuffCount = 0;
+            AFSK_putBit(afsk, 1);
+        }
+        if (byte & 0x01) {
+            afsk->bitstuffCount++;
+            AFSK_putBit(afsk, 0);
+        } else {
+            afsk->bitstuffCount = 0;
+            AFSK_putBit(afsk, 1);
+        }
+        byte >>= 1;
+    }
+}
+
+// Runs from the main loop while we are sending,
+// and turns the preamble, the data in the TX FIFO
+// and the tail into tone bits for the DAC ISR. A
+// byte is only encoded when the bit FIFO has room
+// for two more bytes, since with bitstuffing and
+// the bits left over from the last byte, that is
+// the most we can produce.
+static void AFSK_encode(Afsk *afsk) {
+    // If the ISR ran out of bits in the middle of a
+    // frame, it has started an abort. We finish it,
+    // count the lost frame, and drop whatever is
+    // left of it, up to the next flag.
+    if (afsk->txUnderrun) {
+        ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+            afsk->txUnderrun = false;
+            afsk->txInFrame = false;
+        }
+        afsk->txUnderruns++;
+        afsk->txDropping = true;
+        afsk->abortLength = CONFIG_AFSK_ABORT_LEN;
+    }
+
+    while (!afsk->txDone && fifo_space(&afsk->txBitFifo) >= 2) {
+        if (afsk->abortLength) {
+            afsk->abortLength--;
+            AFSK_encodeByte(afsk, 0xFF, false);
+        } else if (afsk->preambleLength) {
+            afsk->preambleLength--;
+            AFSK_encodeByte(afsk, HDLC_FLAG, false);
+        } else if (!fifo_isempty(&afsk->txFifo)) {
+            const uint8_t *next;
+            fifo_readspan(&afsk->txFifo, &next);
+            uint8_t c = *next;
+            if (c == LLP_ESC) {
+                // Wait until the escaped byte is
+                // here too
+                if (fifo_count(&afsk->txFifo) < 2) return;
+                fifo_pop(&afsk->txFifo);
+                c = fifo_pop(&afsk->txFifo);
+                if (!afsk->txDropping) AFSK_encodeByte(afsk, c, true);
+            } else {
+                fifo_pop(&afsk->txFifo);
+                if (c == HDLC_FLAG || c == HDLC_RESET) {
+                    afsk->txDropping = false;
+                    AFSK_encodeByte(afsk, c, false);
+                } else if (!afsk->txDropping) {
+                    AFSK_encodeByte(afsk, c, true);
+                }
+            }
+        } else if (afsk->tailLength) {
+            afsk->tailLength--;
+            AFSK_encodeByte(afsk, HDLC_FLAG, false);
+        } else {
+            // Pad the last bits out to a whole
+            // byte, without switching tone
+            if (afsk->encodedCount) {
+                fifo_push(&afsk->txBitFifo, afsk->encodedBits);
+                afsk->encodedBits = 0;
+                afsk->encodedCount = 0;
+            }
+            afsk->txDone = true;
+        }
+    }
+}
+
+// Queues as much of the len bytes for transmission
+// as there is room for, starts transmitting if we
+// aren't already, and returns how much was queued.
+// Never waits for the encoder, so callers that
+// need a whole block to go out together must
+// check fifo_space on the TX FIFO first.
+size_t afsk_write(Afsk *afsk, const uint8_t *buf, size_t len) {
+    size_t written = 0;
+    while (written < len) {
+        size_t n = len - written;
+        if (n > FIFO_MAX_SIZE) n = FIFO_MAX_SIZE;
+        n = fifo_push_n(&afsk->txFifo, buf + written, n);
+        if (n == 0) break;
+        written += n;
+    }
+    if (written) AFSK_txStart(afsk);
+    return written;
+}
+
+// Points *span at the bytes received by a slicer
+// that can be read in one go, and returns how many
+// there are. They stay in the buffer until
+// afsk_skip is called.
+uint8_t afsk_readspan(Afsk *afsk, uint8_t slicer, const uint8_t **span) {
+    return fifo_readspan(&afsk->slicers[slicer].rxFifo, span);
+}
+
+void afsk_skip(Afsk *afsk, uint8_t slicer, uint8_t n) {
+    fifo_skip(&afsk->slicers[slicer].rxFifo, n);
+}
+
+// Returns true if any of the slicers is in the
+// middle of receiving a frame
+bool AFSK_receiving(Afsk *afsk) {
+    for (uint8_t i = 0; i < CONFIG_AFSK_SLICERS; i++) {
+        if (afsk->slicers[i].hdlc.receiving) return true;
     }
+    return false;
 }
 
+// The stdio stream interface is only kept for
+// compatibility. The protocols use the buffer
+// functions above.
 int afsk_putchar(char c, FILE *stream) {
-    AFSK_txStart(AFSK_modem);
-    while(fifo_isfull_locked(&AFSK_modem->txFifo)) { /* Wait */ }
-    fifo_push_locked(&AFSK_modem->txFifo, c);
-    return 1;
+    uint8_t b = c;
+    return afsk_write(AFSK_modem, &b, 1) ? 0 : EOF;
 }
 
 int afsk_getchar(FILE *stream) {
-    if (fifo_isempty_locked(&AFSK_modem->rxFifo)) {
+    FIFOBuffer *fifo = &AFSK_modem->slicers[0].rxFifo;
+    if (fifo_isempty(fifo)) {
         return EOF;
     } else {
-        return fifo_pop_locked(&AFSK_modem->rxFifo);
+        return fifo_pop(fifo);
     }
 }
 
-void AFSK_transmit(char *buffer, size_t size) {
+size_t AFSK_transmit(char *buffer, size_t size) {
+    // The TX FIFO is consumed by the encoder in
+    // the main loop, so we can flush it directly
     fifo_flush(&AFSK_modem->txFifo);
-    int i = 0;
-    while (size--) {
-        afsk_putchar(buffer[i++], NULL);
-    }
+
+    return afsk_write(AFSK_modem, (const uint8_t *)buffer, size);
 }
 
+
+// All the encoding has already been done in the
+// main loop, so all the ISR needs to do is to
+// switch tone when the next bit says so. In G3RUH
+// mode, it looks up the shape of the next sample
+// of the current bit instead.
 uint8_t AFSK_dac_isr(Afsk *afsk) {
     if (afsk->sampleIndex == 0) {
-        if (afsk->txBit == 0) {
-            if (fifo_isempty(&afsk->txFifo) && afsk->tailLength == 0) {
+        if (afsk->txBitsLeft == 0) {
+            if (!fifo_isempty(&afsk->txBitFifo)) {
+                afsk->txBits = fifo_pop(&afsk->txBitFifo);
+            } else if (afsk->txDone) {
                 AFSK_DAC_IRQ_STOP();
                 afsk->sending = false;
-                afsk->sending_data = false;
                 LED_TX_OFF();
                 return 0;
             } else {
-                if (!afsk->bitStuff) afsk->bitstuffCount = 0;
-                afsk->bitStuff = true;
-                if (afsk->preambleLength == 0) {
-                    if (fifo_isempty(&afsk->txFifo)) {
-                        afsk->sending_data = false;
-                        afsk->tailLength--;
-                        afsk->currentOutputByte = HDLC_FLAG;
-                    } else {
-                        afsk->currentOutputByte = fifo_pop(&afsk->txFifo);
-                    }
-                } else {
-                    afsk->preambleLength--;
-                    afsk->currentOutputByte = HDLC_FLAG;
-                }
-                if (afsk->currentOutputByte == LLP_ESC) {
-                    if (fifo_isempty(&afsk->txFifo)) {
-                        AFSK_DAC_IRQ_STOP();
-                        afsk->sending = false;
-                        LED_TX_OFF();
-                        return 0;
-                    } else {
-                        afsk->currentOutputByte = fifo_pop(&afsk->txFifo);
-                    }
-                } else if (afsk->currentOutputByte == HDLC_FLAG || afsk->currentOutputByte == HDLC_RESET) {
-                    afsk->bitStuff = false;
-                }
+                // The main loop has fallen behind. In
+                // the middle of a frame we send ones,
+                // which aborts it, and tell the encoder,
+                // which drops the rest of the frame.
+                // Otherwise we send flags until it
+                // catches up. Nothing can be scrambled
+                // here, so in G3RUH mode we just hold
+                // the level, and the encoder sends the
+                // abort when it gets to run.
+                if (afsk->txInFrame) afsk->txUnderrun = true;
+                #if MODULATION == MODULATION_G3RUH
+                    afsk->txBits = (afsk->txShape & 0x01) ? 0xFF : 0x00;
+                #else
+                    afsk->txBits = afsk->txInFrame ? 0x00 : HDLC_FLAG_NRZI;
+                #endif
             }
-            afsk->txBit = 0x01;
+            afsk->txBitsLeft = 8;
         }
 
-        if (afsk->bitStuff && afsk->bitstuffCount >= BIT_STUFF_LEN) {
-            afsk->bitstuffCount = 0;
-            afsk->phaseInc = SWITCH_TONE(afsk->phaseInc);
-        } else {
-            if (afsk->currentOutputByte & afsk->txBit) {
-                afsk->bitstuffCount++;
-            } else {
-                afsk->bitstuffCount = 0;
-                afsk->phaseInc = SWITCH_TONE(afsk->phaseInc);
-            }
-            afsk->txBit <<= 1;
-        }
+        #if MODULATION == MODULATION_G3RUH
+            // The shape of a bit depends on the next
+            // one too, so the DAC runs one bit behind
+            // the bit FIFO
+            afsk->txShape = ((afsk->txShape << 1) | (afsk->txBits & 0x01)) & 0x07;
+        #else
+            if (afsk->txBits & 0x01) afsk->phaseInc = SWITCH_TONE(afsk->profile, afsk->phaseInc);
+        #endif
+        afsk->txBits >>= 1;
+        afsk->txBitsLeft--;
+
+        afsk->sampleIndex = afsk->profile.samplesPerBit;
+    }
+
+    #if MODULATION == MODULATION_G3RUH
+        uint8_t samplesPerBit = afsk->profile.samplesPerBit;
+        afsk->sampleIndex--;
+        return pgm_read_byte(&afsk->profile.shape[afsk->txShape * samplesPerBit + samplesPerBit - 1 - afsk->sampleIndex]);
+    #else
+        // The accumulator wraps around by itself
+        afsk->phaseAcc += afsk->phaseInc;
+        afsk->sampleIndex--;
+
+        return sinSample(afsk->phaseAcc);
+    #endif
+}
+
+static void hdlcAbort(Hdlc *hdlc) {
+    hdlc->receiving = false;
+    hdlc->dcd = false;
+    hdlc->dcd_count = 0;
+}
 
-        afsk->sampleIndex = SAMPLESPERBIT;
+static bool hdlcPushByte(Hdlc *hdlc, uint8_t byte, uint8_t weak, FIFOBuffer *fifo) {
+    // If we have a HDLC control character, put a AX.25 escape
+    // in the received data. We know we need to do this,
+    // because at this point we must have already seen a HDLC
+    // flag, meaning that this control character is the result
+    // of a bitstuffed byte that is equal to said control
+    // character, but is actually part of the data stream.
+    // By inserting the escape character, we tell the protocol
+    // layer that this is not an actual control character, but
+    // data.
+    bool escape = (byte == HDLC_FLAG || byte == HDLC_RESET || byte == LLP_ESC || byte == LLP_SOFT);
+
+    // If the demodulator was unsure about any of the
+    // bits, the byte is preceded by LLP_SOFT and the
+    // mask of those bits.
+    uint8_t needed = 1;
+    if (escape) needed++;
+    if (weak) needed += 2;
+
+    // We also need to check that our received data buffer
+    // has room for all of it before putting anything in
+    if (fifo_space(fifo) < needed) {
+        // If it hasn't, abort and return false
+        hdlcAbort(hdlc);
+        LED_RX_OFF();
+        return false;
     }
 
-    afsk->phaseAcc += afsk->phaseInc;
-    afsk->phaseAcc %= SIN_LEN;
-    afsk->sampleIndex--;
+    if (weak) {
+        fifo_push(fifo, LLP_SOFT);
+        fifo_push(fifo, weak);
+    }
+    if (escape) fifo_push(fifo, LLP_ESC);
+    fifo_push(fifo, byte);
 
-    return sinSample(afsk->phaseAcc);
+    return true;
 }
 
-static bool hdlcParse(Hdlc *hdlc, bool bit, FIFOBuffer *fifo) {
-    // Initialise a return value. We start with the
-    // assumption that all is going to end well :)
+static bool hdlcPutBits(Hdlc *hdlc, uint8_t bits, uint8_t weak, uint8_t count, FIFOBuffer *fifo) {
+    // If we have not yet seen a HDLC_FLAG indicating that
+    // a transmission is actually taking place, don't bother
+    // with anything.
+    if (!hdlc->receiving) {
+        hdlc->dcd = false;
+        hdlc->dcd_count = 0;
+        return true;
+    }
+
+    // Append the new data bits after the ones we
+    // already have. Since we never hold more than
+    // 7 bits between calls, and get at most 8 new
+    // ones, we can complete at most one byte here.
+    // The weak bits are kept in the same way.
+    uint16_t acc = hdlc->currentByte | ((uint16_t)bits << hdlc->bitIndex);
+    uint16_t weakAcc = hdlc->currentWeak | ((uint16_t)weak << hdlc->bitIndex);
+    hdlc->bitIndex += count;
+
+    if (hdlc->bitIndex >= 8) {
+        hdlc->bitIndex -= 8;
+        hdlc->currentByte = acc >> 8;
+        hdlc->currentWeak = weakAcc >> 8;
+        return hdlcPushByte(hdlc, acc & 0xFF, weakAcc & 0xFF, fifo);
+    }
+
+    hdlc->currentByte = acc;
+    hdlc->currentWeak = weakAcc;
+    return true;
+}
+
+static bool hdlcEvent(Hdlc *hdlc, uint8_t event, FIFOBuffer *fifo) {
     bool ret = true;
 
-    // Bitshift our byte of demodulated bits to
-    // the left by one bit, to make room for the
-    // next incoming bit
-    hdlc->demodulatedBits <<= 1;
-    // And then put the newest bit from the 
-    // demodulator into the byte.
-    hdlc->demodulatedBits |= bit ? 1 : 0;
-
-    // Now we'll look at the last 8 received bits, and
-    // check if we have received a HDLC flag (01111110)
-    if (hdlc->demodulatedBits == HDLC_FLAG) {
-        // If we have, check that our output buffer is
-        // not full.
+    if (event == HDLC_EVENT_FLAG) {
+        // We have received a HDLC flag (01111110), so
+        // check that our output buffer is not full.
         if (!fifo_isfull(fifo)) {
             // If it isn't, we'll push the HDLC_FLAG into
             // the buffer and indicate that we are now
@@ -222,11 +537,8 @@ static bool hdlcParse(Hdlc *hdlc, bool bit, FIFOBuffer *fifo) {
             // If the buffer is full, we have a problem
             // and abort by setting the return value to     
             // false and stopping the here.
-            
             ret = false;
-            hdlc->receiving = false;
-            hdlc->dcd = false;
-            hdlc->dcd_count = 0;
+            hdlcAbort(hdlc);
         }
 
         // Everytime we receive a HDLC_FLAG, we reset the
@@ -235,194 +547,303 @@ static bool hdlcParse(Hdlc *hdlc, bool bit, FIFOBuffer *fifo) {
         // synchronises our parsing to  the start and end
         // of the received bytes.
         hdlc->currentByte = 0;
+        hdlc->currentWeak = 0;
         hdlc->bitIndex = 0;
-        return ret;
-    }
-
-    // Check if we have received a RESET flag (01111111)
-    // In this comparison we also detect when no transmission
-    // (or silence) is taking place, and the demodulator
-    // returns an endless stream of zeroes. Due to the NRZ-S
-    // coding, the actual bits send to this function will
-    // be an endless stream of ones, which this AND operation
-    // will also detect.
-    if ((hdlc->demodulatedBits & HDLC_RESET) == HDLC_RESET) {
-        // If we have, something probably went wrong at the
+    } else if (event == HDLC_EVENT_ABORT) {
+        // We have received a RESET flag (01111111), which
+        // means something probably went wrong at the
         // transmitting end, and we abort the reception.
-        hdlc->receiving = false;
-        hdlc->dcd = false;
-        hdlc->dcd_count = 0;
-        return ret;
+        // This also catches silence, since the demodulator
+        // will then return an endless stream of zeroes.
+        // Due to the NRZ-S coding, the actual bits send to
+        // the parser will be an endless stream of ones.
+        // If we were receiving, the protocol layer gets
+        // a HDLC_RESET, so it throws away the frame it
+        // has so far, instead of closing it at the next
+        // flag, which may be a transmission later.
+        if (hdlc->receiving && !fifo_isfull(fifo)) fifo_push(fifo, HDLC_RESET);
+        hdlcAbort(hdlc);
     }
 
-    // Check the DCD status and set RX LED appropriately
-    if (hdlc->dcd) {
-        LED_RX_ON();
-    } else {
-        LED_RX_OFF();
-    }
+    return ret;
+}
 
-    // If we have not yet seen a HDLC_FLAG indicating that
-    // a transmission is actually taking place, don't bother
-    // with anything.
-    if (!hdlc->receiving) {
-        hdlc->dcd = false;
-        hdlc->dcd_count = 0;
+// This is the reference implementation of the
+// deframer, which handles a single bit at a time.
+// It is only used for the rare bytes that contain
+// more than one flag or abort. The generator in
+// tools/hdlc_table.c must follow it exactly, and
+// tools/hdlc_test.c checks that it does.
+static bool hdlcParseBit(Hdlc *hdlc, bool bit, bool weak, FIFOBuffer *fifo) {
+    if (bit) {
+        if (hdlc->ones == 6) {
+            hdlc->ones = 7;
+            return hdlcEvent(hdlc, HDLC_EVENT_ABORT, fifo);
+        } else if (hdlc->ones < 6) {
+            hdlc->ones++;
+            return hdlcPutBits(hdlc, 0x01, weak, 1, fifo);
+        }
+    } else {
+        uint8_t ones = hdlc->ones;
+        hdlc->ones = 0;
 
-        return ret;
+        // A zero after exactly six ones is a flag.
+        // A zero after five ones is a stuffed bit,
+        // which was inserted by the transmitter to
+        // keep data from looking like a control
+        // character, so we just ignore it. A zero
+        // after an abort sequence carries no data.
+        if (ones == 6) {
+            return hdlcEvent(hdlc, HDLC_EVENT_FLAG, fifo);
+        } else if (ones < 5) {
+            return hdlcPutBits(hdlc, 0x00, weak, 1, fifo);
+        }
     }
 
-    // First check if what we are seeing is a stuffed bit.
-    // Since the different HDLC control characters like
-    // HDLC_FLAG, HDLC_RESET and such could also occur in
-    // a normal data stream, we employ a method known as
-    // "bit stuffing". All control characters have more than
-    // 5 ones in a row, so if the transmitting party detects
-    // this sequence in the _data_ to be transmitted, it inserts
-    // a zero to avoid the receiving party interpreting it as
-    // a control character. Therefore, if we detect such a
-    // "stuffed bit", we simply ignore it and wait for the
-    // next bit to come in.
-    // 
-    // We do the detection by applying an AND bit-mask to the
-    // stream of demodulated bits. This mask is 00111111 (0x3f)
-    // if the result of the operation is 00111110 (0x3e), we
-    // have detected a stuffed bit.
-    if ((hdlc->demodulatedBits & 0x3f) == 0x3e)
-        return ret;
+    return true;
+}
 
-    // If we have an actual 1 bit, push this to the current byte
-    // If it's a zero, we don't need to do anything, since the
-    // bit is initialized to zero when we bitshifted earlier.
-    if (hdlc->demodulatedBits & 0x01)
-        hdlc->currentByte |= 0x80;
-
-    // Increment the bitIndex and check if we have a complete byte
-    if (++hdlc->bitIndex >= 8) {
-        // If we have a HDLC control character, put a AX.25 escape
-        // in the received data. We know we need to do this,
-        // because at this point we must have already seen a HDLC
-        // flag, meaning that this control character is the result
-        // of a bitstuffed byte that is equal to said control
-        // character, but is actually part of the data stream.
-        // By inserting the escape character, we tell the protocol
-        // layer that this is not an actual control character, but
-        // data.
-        if ((hdlc->currentByte == HDLC_FLAG ||
-             hdlc->currentByte == HDLC_RESET ||
-             hdlc->currentByte == LLP_ESC)) {
-            // We also need to check that our received data buffer
-            // is not full before putting more data in
-            if (!fifo_isfull(fifo)) {
-                fifo_push(fifo, LLP_ESC);
-            } else {
-                // If it is, abort and return false
-                hdlc->receiving = false;
-                hdlc->dcd = false;
-                hdlc->dcd_count = 0;
-                LED_RX_OFF();
-                ret = false;
-            }
+// Picks out the bits that the keep mask of a
+// table entry says are data bits, and packs them
+// together, earliest bit in the LSB. This is how
+// the weak bits are destuffed along with the data.
+static uint8_t hdlcDestuff(uint8_t bits, uint8_t keep) {
+    uint8_t out = 0;
+    uint8_t bit = 0x01;
+    while (keep) {
+        if (keep & 0x01) {
+            if (bits & 0x01) out |= bit;
+            bit <<= 1;
         }
+        keep >>= 1;
+        bits >>= 1;
+    }
+    return out;
+}
 
-        // Push the actual byte to the received data FIFO,
-        // if it isn't full.
-        if (!fifo_isfull(fifo)) {
-            fifo_push(fifo, hdlc->currentByte);
-        } else {
-            // If it is, well, you know by now!
-            hdlc->receiving = false;
-            hdlc->dcd = false;
-            hdlc->dcd_count = 0;
-            LED_RX_OFF();
-            ret = false;
-        }
+static bool hdlcParse(Hdlc *hdlc, uint8_t bits, uint8_t weak, FIFOBuffer *fifo) {
+    // Initialise a return value. We start with the
+    // assumption that all is going to end well :)
+    bool ret = true;
 
-        // Wipe received byte and reset bit index to 0
-        hdlc->currentByte = 0;
-        hdlc->bitIndex = 0;
+    // Look up what these 8 bits mean, given the
+    // number of consecutive ones we had seen before
+    // them. The table entry gives us the data bits
+    // with stuffed bits removed, whether a flag or
+    // an abort was found, and where in the data it
+    // happened.
+    const HdlcRxEntry *entry = &hdlc_rx_table[hdlc->ones][bits];
+    uint8_t data  = pgm_read_byte(&entry->bits);
+    uint8_t count = pgm_read_byte(&entry->count);
+    uint8_t ctrl  = pgm_read_byte(&entry->ctrl);
+    uint8_t event = HDLC_RX_EVENT(ctrl);
+
+    // If the demodulator was unsure about any of the
+    // bits, the weak bits are destuffed too, so they
+    // follow the data bits they belong to. Usually
+    // no bits were removed, and the mask is used as
+    // it is. Otherwise it takes at most 8 rounds of
+    // a short loop, which is still a lot less work
+    // than parsing the byte one bit at a time.
+    if (weak && event != HDLC_EVENT_MULTI) {
+        uint8_t keep = pgm_read_byte(&entry->keep);
+        if (keep != 0xFF) weak = hdlcDestuff(weak, keep);
+    }
 
+    if (event == HDLC_EVENT_NONE) {
+        ret = hdlcPutBits(hdlc, data, weak, count, fifo);
+    } else if (event == HDLC_EVENT_MULTI) {
+        // Several flags or aborts in one byte is rare
+        // enough that we just go through it bit by bit
+        for (uint8_t i = 0; i < 8; i++) {
+            if (!hdlcParseBit(hdlc, (bits >> i) & 0x01, (weak >> i) & 0x01, fifo)) ret = false;
+        }
+        return ret;
     } else {
-        // We don't have a full byte yet, bitshift the byte
-        // to make room for the next bit
-        hdlc->currentByte >>= 1;
+        // Data bits before the event might complete
+        // the byte we are currently receiving, so
+        // they go in first. Then we handle the event,
+        // and finally the data bits after it.
+        uint8_t split = HDLC_RX_SPLIT(ctrl);
+        uint8_t below = (1 << split) - 1;
+        if (!hdlcPutBits(hdlc, data & below, weak & below, split, fifo)) ret = false;
+        if (!hdlcEvent(hdlc, event, fifo)) ret = false;
+        if (!hdlcPutBits(hdlc, data >> split, weak >> split, count - split, fifo)) ret = false;
     }
 
+    hdlc->ones = HDLC_RX_ONES(ctrl);
+
     return ret;
 }
 
 
-void AFSK_adc_isr(Afsk *afsk, int8_t currentSample) {
+#if MODULATION == MODULATION_G3RUH
+static int16_t AFSK_baseband(Afsk *afsk, int8_t currentSample) {
+    // The G3RUH signal comes straight out of the
+    // discriminator of the radio, so all we need
+    // is a little lowpass filtering. The filter is
+    // a 1-2-1 window over the last three samples,
+    // which has a null at half the sample rate and
+    // takes out most of the noise above the signal.
+    // The level itself tells us the bit.
+    int16_t level = (int16_t)currentSample + 2 * afsk->lastSample[0] + afsk->lastSample[1];
+    afsk->lastSample[1] = afsk->lastSample[0];
+    afsk->lastSample[0] = currentSample;
+    return level;
+}
+#else
+// Runs one of the filters from the profile. The
+// caller has already done the numerator, and we
+// apply the gain and the feedback from the last
+// two outputs, which are kept in y, newest first.
+static int16_t AFSK_biquad(const AfskBiquad *filter, int16_t *y, int16_t numerator) {
+    int32_t acc = (int32_t)numerator * filter->b0
+                - (int32_t)filter->a1 * y[0]
+                - (int32_t)filter->a2 * y[1];
+    acc >>= AFSK_FILTER_FRAC;
+    if (acc > INT16_MAX) acc = INT16_MAX;
+    if (acc < INT16_MIN) acc = INT16_MIN;
+
+    y[1] = y[0];
+    y[0] = acc;
+    return acc;
+}
+
+// The band-pass filter in front of the demodulator
+// passes both tones of the profile, and takes out
+// the noise and whatever else the radio lets
+// through around them.
+static int8_t AFSK_bandpass(Afsk *afsk, int8_t currentSample) {
+    // Profiles that do better without the filter
+    // have no gain for it
+    if (afsk->profile.band.b0 == 0) return currentSample;
+
+    int16_t numerator = ((int16_t)currentSample - afsk->bandX[1]) << AFSK_BAND_SHIFT;
+    afsk->bandX[1] = afsk->bandX[0];
+    afsk->bandX[0] = currentSample;
+
+    int16_t sample = AFSK_biquad(&afsk->profile.band, afsk->bandY, numerator) >> AFSK_BAND_SHIFT;
+    if (sample > 127) sample = 127;
+    if (sample < -128) sample = -128;
+    return sample;
+}
+#endif
+
+#if MODULATION == MODULATION_AFSK && AFSK_DEMODULATOR == AFSK_DEMOD_DISCRIMINATOR
+static int16_t AFSK_discriminate(Afsk *afsk, int8_t currentSample) {
     // To determine the received frequency, and thereby
     // the bit of the sample, we multiply the sample by
     // a sample delayed by (samples per bit / 2).
-    // We then lowpass-filter the samples with a
-    // Chebyshev filter. The lowpass filtering serves
-    // to "smooth out" the variations in the samples.
-
-    afsk->iirX[0] = afsk->iirX[1];
-
-    #if FILTER_CUTOFF == 600
-        afsk->iirX[1] = ((int8_t)fifo_pop(&afsk->delayFifo) * currentSample) >> 2;
-        // The above is a simplification of:
-        // afsk->iirX[1] = ((int8_t)fifo_pop(&afsk->delayFifo) * currentSample) / 3.558147322;
-    #elif FILTER_CUTOFF == 800
-        afsk->iirX[1] = ((int8_t)fifo_pop(&afsk->delayFifo) * currentSample) >> 2;
-        // The above is a simplification of:
-        // afsk->iirX[1] = ((int8_t)fifo_pop(&afsk->delayFifo) * currentSample) / 2.899043379;
-    #elif FILTER_CUTOFF == 1200
-        afsk->iirX[1] = ((int8_t)fifo_pop(&afsk->delayFifo) * currentSample) >> 1;
-        // The above is a simplification of:
-        // afsk->iirX[1] = ((int8_t)fifo_pop(&afsk->delayFifo) * currentSample) / 2.228465666;
-    #elif FILTER_CUTOFF == 1600
-        afsk->iirX[1] = ((int8_t)fifo_pop(&afsk->delayFifo) * currentSample) >> 1;
-        // The above is a simplification of:
-        // afsk->iirX[1] = ((int8_t)fifo_pop(&afsk->delayFifo) * currentSample) / 1.881349100;
-    #else
-        #error Unsupported filter cutoff!
-    #endif
+    // We then lowpass-filter the products with the
+    // second-order Butterworth filter of the profile.
+    // The lowpass filtering serves to "smooth out"
+    // the variations in the samples. The result is
+    // positive for space and negative for mark.
+    int16_t product = ((int8_t)fifo_pop(&afsk->delayFifo) * currentSample) >> AFSK_PRODUCT_SHIFT;
+    int16_t numerator = product + 2 * afsk->iirX[0] + afsk->iirX[1];
+    afsk->iirX[1] = afsk->iirX[0];
+    afsk->iirX[0] = product;
 
-    afsk->iirY[0] = afsk->iirY[1];
-    
-    #if FILTER_CUTOFF == 600
-        afsk->iirY[1] = afsk->iirX[0] + afsk->iirX[1] + (afsk->iirY[0] >> 1);
-        // The above is a simplification of a first-order 600Hz chebyshev filter:
-        // afsk->iirY[1] = afsk->iirX[0] + afsk->iirX[1] + (afsk->iirY[0] * 0.4379097269);
-    #elif FILTER_CUTOFF == 800
-        afsk->iirY[1] = afsk->iirX[0] + afsk->iirX[1] + (afsk->iirY[0] / 3);
-        // The above is a simplification of a first-order 800Hz chebyshev filter:
-        // afsk->iirY[1] = afsk->iirX[0] + afsk->iirX[1] + (afsk->iirY[0] * 0.3101172565);
-    #elif FILTER_CUTOFF == 1200
-        afsk->iirY[1] = afsk->iirX[0] + afsk->iirX[1] + (afsk->iirY[0] / 10);
-        // The above is a simplification of a first-order 1200Hz chebyshev filter:
-        // afsk->iirY[1] = afsk->iirX[0] + afsk->iirX[1] + (afsk->iirY[0] * 0.1025215106);
-    #elif FILTER_CUTOFF == 1600
-        afsk->iirY[1] = afsk->iirX[0] + afsk->iirX[1] + -1*(afsk->iirY[0] / 17);
-        // The above is a simplification of a first-order 1600Hz chebyshev filter:
-        // afsk->iirY[1] = afsk->iirX[0] + afsk->iirX[1] + (afsk->iirY[0] * -0.0630669239);
-    #else
-        #error Unsupported filter cutoff!
-    #endif
+    // Put the current raw sample in the delay FIFO
+    fifo_push(&afsk->delayFifo, currentSample);
+
+    return AFSK_biquad(&afsk->profile.lowpass, afsk->iirY, numerator);
+}
+#elif MODULATION == MODULATION_AFSK && AFSK_DEMODULATOR == AFSK_DEMOD_CORRELATOR
+// Reference tones for the correlators are taken
+// from the same sine table as the modulator uses,
+// just shifted to be signed. The cosine is the
+// same table a quarter period further along.
+#define REF_SIN(phase) ((int8_t)(sinSample(phase) - 128))
+#define REF_COS(phase) ((int8_t)(sinSample((phase) + 16384) - 128))
+
+// Products are scaled down so that a full bit
+// worth of them always fits in the 16 bit sums
+#define CORR_SHIFT 6
+
+static int16_t AFSK_magnitude(int16_t i, int16_t q) {
+    // Approximates sqrt(i*i + q*q) as the largest
+    // of the two plus half the smallest. It is off
+    // by at most about 12%, but it is off in the
+    // same way for both tones, which is what counts.
+    if (i < 0) i = -i;
+    if (q < 0) q = -q;
+    return (i > q) ? i + (q >> 1) : q + (i >> 1);
+}
+
+static int16_t AFSK_correlate(Afsk *afsk, int8_t currentSample) {
+    // The correlator demodulator compares the energy
+    // of the mark and space tones over the last bit
+    // worth of samples. For each tone, the samples
+    // are multiplied by a sine and a cosine of the
+    // tone frequency and summed, and the magnitude of
+    // the two sums tells us how much of that tone is
+    // in the window, regardless of its phase.
+    //
+    // Unlike the delay-line discriminator, which
+    // multiplies the signal by itself, each tone is
+    // measured on its own here. When a radio with
+    // de-emphasis makes one tone much weaker than the
+    // other, the weak tone is still compared against
+    // the full energy of the strong one, instead of
+    // being mixed up with it first.
+    //
+    // The sums are kept as sliding sums. Every sample
+    // we add the products for the newest sample and
+    // subtract the products for the sample falling
+    // out of the window. The reference phase of that
+    // old sample is simply the current phase minus a
+    // bit worth of phase increments, so the products
+    // we subtract are exactly the ones we once added,
+    // and the sums never drift.
+    int8_t oldSample = (int8_t)fifo_pop(&afsk->delayFifo);
+    fifo_push(&afsk->delayFifo, currentSample);
+
+    uint16_t markInc  = afsk->profile.markInc;
+    uint16_t spaceInc = afsk->profile.spaceInc;
+    uint16_t markOld  = afsk->markPhase  - (uint16_t)(afsk->profile.samplesPerBit * markInc);
+    uint16_t spaceOld = afsk->spacePhase - (uint16_t)(afsk->profile.samplesPerBit * spaceInc);
 
+    afsk->markI  += ((currentSample * REF_SIN(afsk->markPhase)) >> CORR_SHIFT)
+                  - ((oldSample * REF_SIN(markOld)) >> CORR_SHIFT);
+    afsk->markQ  += ((currentSample * REF_COS(afsk->markPhase)) >> CORR_SHIFT)
+                  - ((oldSample * REF_COS(markOld)) >> CORR_SHIFT);
+    afsk->spaceI += ((currentSample * REF_SIN(afsk->spacePhase)) >> CORR_SHIFT)
+                  - ((oldSample * REF_SIN(spaceOld)) >> CORR_SHIFT);
+    afsk->spaceQ += ((currentSample * REF_COS(afsk->spacePhase)) >> CORR_SHIFT)
+                  - ((oldSample * REF_COS(spaceOld)) >> CORR_SHIFT);
 
+    afsk->markPhase  += markInc;
+    afsk->spacePhase += spaceInc;
+
+    // Like the discriminator output, the result is
+    // positive for space and negative for mark
+    return AFSK_magnitude(afsk->spaceI, afsk->spaceQ) - AFSK_magnitude(afsk->markI, afsk->markQ);
+}
+#elif MODULATION == MODULATION_AFSK
+    #error Unsupported demodulator!
+#endif
+
+// Runs one slicer for one sample. The bit is the
+// slicer's decision for this sample, 1 for mark
+// and 0 for space.
+static void AFSK_slice(Afsk *afsk, AfskSlicer *slicer, uint8_t bit) {
     // We put the sampled bit in a delay-line:
     // First we bitshift everything 1 left
-    afsk->sampledBits <<= 1;
+    slicer->sampledBits <<= 1;
     // And then add the sampled bit to our delay line
-    afsk->sampledBits |= (afsk->iirY[1] > 0) ? 0 : 1;
-
-    // Put the current raw sample in the delay FIFO
-    fifo_push(&afsk->delayFifo, currentSample);
+    slicer->sampledBits |= bit;
 
     // We need to check whether there is a signal transition.
     // If there is, we can recalibrate the phase of our 
     // sampler to stay in sync with the transmitter. A bit of
     // explanation is required to understand how this works.
-    // Since we have PHASE_MAX/PHASE_BITS = 8 samples per bit,
+    // Since the profile gives us a number of samples per bit,
     // we employ a phase counter (currentPhase), that increments
-    // by PHASE_BITS everytime a sample is captured. When this
-    // counter reaches PHASE_MAX, it wraps around by modulus
-    // PHASE_MAX. We then look at the last three samples we
+    // by the profile's phase bits everytime a sample is captured.
+    // When this counter reaches the maximum phase, samples per
+    // bit times phase bits, it wraps around by modulus of that
+    // maximum. We then look at the last three samples we
     // captured and determine if the bit was a one or a zero.
     //
     // This gives us a "window" looking into the stream of
@@ -434,66 +855,107 @@ void AFSK_adc_isr(Afsk *afsk, int8_t currentSample) {
     //                       ||     
     //                     Window
     //
-    // Every time we detect a signal transition, we adjust
-    // where this window is positioned a little. How much we
-    // adjust it is defined by PHASE_INC. If our current phase
-    // phase counter value is less than half of PHASE_MAX (ie, 
-    // the window size) when a signal transition is detected,
-    // add PHASE_INC to our phase counter, effectively moving
-    // the window a little bit backward (to the left in the
-    // illustration), inversely, if the phase counter is greater
-    // than half of PHASE_MAX, we move it forward a little.
-    // This way, our "window" is constantly seeking to position
-    // it's center at the bit transitions. Thus, we synchronise
-    // our timing to the transmitter, even if it's timing is
-    // a little off compared to our own.
-    if (SIGNAL_TRANSITIONED(afsk->sampledBits)) {
-        if (afsk->currentPhase < PHASE_THRESHOLD) {
-            afsk->currentPhase += PHASE_INC;
+    // Every time we detect a signal transition, we look at
+    // how far the phase counter is from half the maximum
+    // phase, where the transitions should be. That difference is
+    // the phase error, and we move the window by a part of
+    // it, which is the proportional term of the loop. A
+    // smaller part of the error is also added up in the
+    // phase drift, the integral term, which is added to
+    // the phase counter on every sample. If the transmitter
+    // clock runs a little faster or slower than ours, the
+    // drift grows until it makes up for the difference, and
+    // the window stays centred without having to be pushed
+    // back on every transition.
+    if (SIGNAL_TRANSITIONED(slicer->sampledBits)) {
+        int16_t error = (afsk->pllPhaseMax >> 1) - slicer->currentPhase;
+
+        if (slicer->hdlc.dcd) {
+            slicer->currentPhase += error >> CONFIG_PLL_TRACK_KP;
+            slicer->phaseDrift += error >> CONFIG_PLL_TRACK_KI;
+
+            // Single transitions can be far off because
+            // of noise, but if the average error keeps
+            // growing, the window is drifting over a
+            // bit boundary and we count a slip
+            slicer->phaseError += (error - slicer->phaseError) >> 3;
+            int16_t slipError = afsk->pllPhaseMax >> PLL_SLIP_SHIFT;
+            if (slicer->phaseError > slipError || slicer->phaseError < -slipError) {
+                afsk->pllSlips++;
+                slicer->phaseError = 0;
+            }
         } else {
-            afsk->currentPhase -= PHASE_INC;
+            slicer->phaseError = 0;
+            slicer->currentPhase += error >> CONFIG_PLL_ACQ_KP;
+            slicer->phaseDrift += error >> CONFIG_PLL_ACQ_KI;
         }
-        afsk->silentSamples = 0;
+
+        int16_t freqLimit = afsk->pllPhaseStep >> PLL_FREQ_SHIFT;
+        if (slicer->phaseDrift > freqLimit) slicer->phaseDrift = freqLimit;
+        if (slicer->phaseDrift < -freqLimit) slicer->phaseDrift = -freqLimit;
+
+        slicer->silentSamples = 0;
     } else {
-        afsk->silentSamples++;
+        slicer->silentSamples++;
     }
 
     // We increment our phase counter
-    afsk->currentPhase += PHASE_BITS;
+    slicer->currentPhase += afsk->pllPhaseStep + slicer->phaseDrift;
 
     // Check if we have reached the end of
     // our sampling window.
-    if (afsk->currentPhase >= PHASE_MAX) {
+    if (slicer->currentPhase >= afsk->pllPhaseMax) {
         // If we have, wrap around our phase
         // counter by modulus
-        afsk->currentPhase %= PHASE_MAX;
-
-        // Bitshift to make room for the next
-        // bit in our stream of demodulated bits
-        afsk->actualBits <<= 1;
+        slicer->currentPhase -= afsk->pllPhaseMax;
 
         // We determine the actual bit value by reading
         // the last 3 sampled bits. If there is two or
         // more 1's, we will assume that the transmitter
         // sent us a one, otherwise we assume a zero
-        uint8_t bits = afsk->sampledBits & 0x07;
+        uint8_t bits = slicer->sampledBits & 0x07;
+        uint8_t bit = 0;
         if (bits == 0x07 || // 111
             bits == 0x06 || // 110
             bits == 0x05 || // 101
             bits == 0x03    // 011
             ) {
-            afsk->actualBits |= 1;
+            bit = 1;
         }
 
+        // If the three samples did not all agree, the
+        // bit is weak, and the protocol layer can use
+        // that to pick which bits to flip when it
+        // corrects errors
+        uint8_t weak = (bits != 0x07 && bits != 0x00);
+
+        #if MODULATION == MODULATION_G3RUH
+            // In G3RUH mode, the line bits have to be
+            // descrambled before the NRZI decoding. A
+            // wrong line bit ends up in three of the
+            // descrambled bits, so all of those are
+            // weak if it was.
+            bit = g3ruh_descramble(&slicer->descrambler, bit);
+
+            uint8_t lineWeak = weak;
+            weak |= ((slicer->descramblerWeak >> G3RUH_TAP_A) | (slicer->descramblerWeak >> G3RUH_TAP_B)) & 0x01;
+            slicer->descramblerWeak = (slicer->descramblerWeak << 1) | lineWeak;
+        #endif
+
+        // Shift the bit into our stream of
+        // demodulated bits
+        slicer->actualBits = (slicer->actualBits << 1) | bit;
+        slicer->actualWeak = (slicer->actualWeak << 1) | weak;
+
          //// Alternative using five bits ////////////////
-         // uint8_t bits = afsk->sampledBits & 0x0f;
+         // uint8_t bits = slicer->sampledBits & 0x0f;
          // uint8_t c = 0;
          // c += bits & BV(1);
          // c += bits & BV(2);
          // c += bits & BV(3);
          // c += bits & BV(4);
          // c += bits & BV(5);
-         // if (c >= 3) afsk->actualBits |= 1;
+         // if (c >= 3) slicer->actualBits |= 1;
         /////////////////////////////////////////////////
 
         // Now we can pass the actual bit to the HDLC parser.
@@ -513,34 +975,310 @@ void AFSK_adc_isr(Afsk *afsk, int8_t currentSample) {
         // that the signal will regularly make transitions
         // that we can use to synchronize our phase.
         //
+        // The HDLC parser works on 8 bits at a time, so
+        // we collect the bits here until we have a byte.
         // We also check the return of the Link Control parser
         // to check if an error occured.
+        Hdlc *hdlc = &slicer->hdlc;
+        hdlc->demodulatedBits >>= 1;
+        if (!TRANSITION_FOUND(slicer->actualBits)) hdlc->demodulatedBits |= 0x80;
+
+        // The decoded bit depends on the last two
+        // bits, so it is weak if either of them was
+        hdlc->demodulatedWeak >>= 1;
+        if (slicer->actualWeak & 0x03) hdlc->demodulatedWeak |= 0x80;
+
+        // We count the bits from the first flag until
+        // DCD is declared, which tells the host how
+        // long the loop took to lock. The shortest
+        // possible time is DCD_MIN_COUNT flags, and
+        // every flag lost on the way adds to it.
+        if (!hdlc->receiving) {
+            slicer->lockBits = 0;
+        } else if (!hdlc->dcd && slicer->lockBits < UINT16_MAX) {
+            slicer->lockBits++;
+        }
 
-        if (!hdlcParse(&afsk->hdlc, !TRANSITION_FOUND(afsk->actualBits), &afsk->rxFifo)) {
-            afsk->status |= 1;
-            if (fifo_isfull(&afsk->rxFifo)) {
-                fifo_flush(&afsk->rxFifo);
-                afsk->status = 0;
+        if (++hdlc->demodulatedCount == 8) {
+            hdlc->demodulatedCount = 0;
+            bool locked = hdlc->dcd;
+            if (!hdlcParse(hdlc, hdlc->demodulatedBits, hdlc->demodulatedWeak, &slicer->rxFifo)) {
+                afsk->status |= 1;
+                if (fifo_isfull(&slicer->rxFifo)) {
+                    fifo_flush(&slicer->rxFifo);
+                    afsk->status = 0;
+                }
             }
+            if (!locked && hdlc->dcd) afsk->pllLockTime = slicer->lockBits;
         }
     }
 
-    if (afsk->silentSamples > DCD_TIMEOUT_SAMPLES) {
-        afsk->silentSamples = 0;
-        afsk->hdlc.dcd = false;
+    if (slicer->silentSamples > afsk->dcdTimeout) {
+        slicer->silentSamples = 0;
+        slicer->hdlc.dcd = false;
+    }
+}
+
+#if CONFIG_AFSK_SLICERS > 1
+// Decision thresholds of the slicers, in eighths
+// of the average demodulator output. The first
+// slicer is the plain zero crossing. The others
+// lean towards mark or space, which is where the
+// best threshold ends up when one tone comes out
+// of the radio weaker than the other.
+static const int8_t slicerThresholds[4] PROGMEM = { 0, -4, 4, -6 };
+#endif
+
+static void AFSK_demodulate(Afsk *afsk, int8_t currentSample) {
+    #if MODULATION == MODULATION_G3RUH
+        int16_t tone = AFSK_baseband(afsk, currentSample);
+    #elif AFSK_DEMODULATOR == AFSK_DEMOD_CORRELATOR
+        int16_t tone = AFSK_correlate(afsk, AFSK_bandpass(afsk, currentSample));
+    #else
+        int16_t tone = AFSK_discriminate(afsk, AFSK_bandpass(afsk, currentSample));
+    #endif
+
+    #if CONFIG_AFSK_SLICERS > 1
+        // Track the average size of the demodulator
+        // output, so the thresholds follow the level
+        // of the received audio
+        int16_t size = (tone < 0) ? -tone : tone;
+        afsk->level += (size - afsk->level) >> 4;
+
+        bool dcd = false;
+        int16_t step = afsk->level >> 3;
+        for (uint8_t i = 0; i < CONFIG_AFSK_SLICERS; i++) {
+            int16_t threshold = step * (int8_t)pgm_read_byte(&slicerThresholds[i]);
+            AfskSlicer *slicer = &afsk->slicers[i];
+            AFSK_slice(afsk, slicer, (tone > threshold) ? 0 : 1);
+            dcd |= slicer->hdlc.dcd;
+        }
+    #else
+        AFSK_slice(afsk, &afsk->slicers[0], (tone > 0) ? 0 : 1);
+        bool dcd = afsk->slicers[0].hdlc.dcd;
+    #endif
+
+    // The RX LED shows whether any of the slicers
+    // has found a signal
+    if (dcd) {
+        LED_RX_ON();
+    } else {
         LED_RX_OFF();
     }
+}
+
+
+#if CONFIG_AFSK_AGC
+// Runs the DC offset estimator and the AGC on the
+// samples coming out of the ADC ISR. Since those
+// samples already have the current offset and
+// gain applied, whatever DC is left in them is the
+// error of the offset estimate, and their peaks
+// tell us whether the gain is right.
+static void AFSK_agc(Afsk *afsk, int8_t sample) {
+    afsk->agcSum += sample;
+    uint8_t size = (sample < 0) ? -sample : sample;
+    if (size > afsk->agcPeak) afsk->agcPeak = size;
+    if (++afsk->agcCount < AGC_BLOCK) return;
+
+    uint16_t gain = afsk->adcGain;
+    uint8_t peak = afsk->agcPeak;
+
+    // The remaining offset, converted back to ADC
+    // counts, is the block average divided by the
+    // gain. We correct a part of it every block,
+    // so the estimate settles quickly, but is not
+    // pulled around by the signal itself.
+    int32_t error = ((int32_t)afsk->agcSum << (AGC_GAIN_FRAC + ADC_BIAS_FRAC + 2 - ADC_BIAS_SHIFT)) / AGC_BLOCK;
+    afsk->biasEstimate += error / gain;
+    if (afsk->biasEstimate < 0) afsk->biasEstimate = 0;
+    if (afsk->biasEstimate > (1023 << ADC_BIAS_FRAC)) afsk->biasEstimate = 1023 << ADC_BIAS_FRAC;
+
+    // Record the input level in ADC counts, so the
+    // host can see how hard the radio drives us
+    afsk->inputLevel = ((uint32_t)peak << (AGC_GAIN_FRAC + 2)) / gain;
+
+    if (peak >= AGC_CLIP) {
+        gain -= gain >> 2;
+    } else if (peak >= AGC_TARGET_HIGH) {
+        gain -= gain >> 5;
+    } else if (peak < AGC_TARGET_LOW && !AFSK_receiving(afsk)) {
+        gain += (gain >> 6) + 1;
+    }
+    if (gain < AGC_GAIN_UNITY) gain = AGC_GAIN_UNITY;
+    if (gain > AGC_GAIN_MAX) gain = AGC_GAIN_MAX;
+
+    // Split the gain into the shift and the scale
+    // the ISR uses. The scale is the top bits of
+    // what is left after the shift.
+    uint8_t shift = 0;
+    while ((gain >> shift) >= 2 * AGC_GAIN_UNITY) shift++;
+    uint8_t scale = gain >> (shift + AGC_GAIN_FRAC - AGC_SCALE_FRAC);
+    afsk->adcGain = gain;
+
+    uint16_t bias = (afsk->biasEstimate + (1 << (ADC_BIAS_FRAC - 1))) >> ADC_BIAS_FRAC;
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+        afsk->adcBias = bias;
+        afsk->adcShift = shift;
+        afsk->adcScale = scale;
+    }
+
+    afsk->agcSum = 0;
+    afsk->agcPeak = 0;
+    afsk->agcCount = 0;
+}
+#endif
+
+#if CONFIG_AFSK_AUTOPROFILE
+// Looks for the preamble flags of every profile in
+// the received audio, and switches the demodulator
+// to the profile of the flags it finds.
+static void AFSK_detect(Afsk *afsk, int8_t sample) {
+    // This is a plain delay-line discriminator, with
+    // a fixed delay and a cheap first-order filter
+    // at about 600Hz, since only the run lengths
+    // of the flags matter here
+    uint8_t index = afsk->detectIndex++;
+    int8_t delayed = afsk->detectBuf[(uint8_t)(index - AFSK_DETECT_DELAY) & (AFSK_DETECT_BUFLEN - 1)];
+    afsk->detectBuf[index & (AFSK_DETECT_BUFLEN - 1)] = sample;
+
+    int16_t x = (delayed * sample) >> 2;
+    afsk->detectY = afsk->detectX + x + (afsk->detectY >> 1);
+    afsk->detectX = x;
+
+    if (afsk->detectRun < UINT8_MAX) afsk->detectRun++;
+    bool tone = afsk->detectY > 0;
+    if (tone == afsk->detectTone) return;
+    afsk->detectTone = tone;
+
+    // The tone changed, so we have the length of
+    // another run. A flag is a run of one bit and
+    // one of seven, together eight bits. The
+    // filter moves the change in the middle a bit
+    // depending on the tones, so we only need the
+    // pair to be within half a bit of eight bits,
+    // with the second run at least six bits long.
+    uint8_t run = afsk->detectRun;
+    uint8_t lastRun = afsk->detectLastRun;
+    afsk->detectLastRun = run;
+    afsk->detectRun = 0;
+    if (afsk->detectRuns < UINT8_MAX) afsk->detectRuns++;
+
+    for (uint8_t i = 0; i < AFSK_PROFILES; i++) {
+        uint8_t samplesPerBit = pgm_read_byte(&afskProfiles[i].samplesPerBit);
+        uint8_t tolerance = samplesPerBit / 2;
+        uint16_t flagLength = (uint16_t)run + lastRun;
+        if (flagLength < samplesPerBit * 8 - tolerance || flagLength > samplesPerBit * 8 + tolerance) continue;
+        if (run < samplesPerBit * 6) continue;
+
+        // Data can look like a flag now and then,
+        // but only a preamble has them back to
+        // back, two runs apart
+        if (i == afsk->detectProfile && afsk->detectRuns == 2) {
+            if (afsk->detectCount < AFSK_DETECT_FLAGS) afsk->detectCount++;
+        } else {
+            afsk->detectProfile = i;
+            afsk->detectCount = 1;
+        }
+        afsk->detectRuns = 0;
+
+        // A slicer that has DCD is in the middle of
+        // receiving with the current profile, and
+        // we never cut that short
+        if (afsk->detectCount < AFSK_DETECT_FLAGS || i == afsk->profileIndex || afsk->sending) return;
+        for (uint8_t j = 0; j < CONFIG_AFSK_SLICERS; j++) {
+            if (afsk->slicers[j].hdlc.dcd) return;
+        }
+        AFSK_loadProfile(afsk, i);
+        return;
+    }
+}
+#endif
 
+void AFSK_poll(Afsk *afsk) {
+    // The ADC ISR only captures raw samples, so
+    // this is where the actual demodulation work
+    // happens. We process the samples in batches
+    // of at most CONFIG_AFSK_RX_BATCH, so that
+    // the rest of the main loop still gets to run
+    // regularly, even if we have fallen behind.
+    //
+    // The samples are read directly out of the
+    // FIFO storage, and only released back to
+    // the ISR when the whole batch is done.
+    const uint8_t *samples;
+    uint8_t n = fifo_readspan(&afsk->adcFifo, &samples);
+    if (n > CONFIG_AFSK_RX_BATCH) n = CONFIG_AFSK_RX_BATCH;
+
+    #if MODULATION == MODULATION_G3RUH
+        // At the G3RUH sample rates, the main loop
+        // needs all the time it can get to keep the
+        // encoder ahead of the DAC, so we don't
+        // listen to ourselves while sending
+        if (afsk->sending) {
+            fifo_flush(&afsk->adcFifo);
+            n = 0;
+        }
+    #endif
+
+    for (uint8_t i = 0; i < n; i++) {
+        #if CONFIG_AFSK_AGC
+            AFSK_agc(afsk, (int8_t)samples[i]);
+        #endif
+        #if CONFIG_AFSK_AUTOPROFILE
+            AFSK_detect(afsk, (int8_t)samples[i]);
+        #endif
+        AFSK_demodulate(afsk, (int8_t)samples[i]);
+    }
+    fifo_skip(&afsk->adcFifo, n);
+
+    if (afsk->sending) AFSK_encode(afsk);
 }
 
 
+// The DAC sample for this tick was computed in the
+// previous one, and is written out before anything
+// else, so the write no longer comes after the
+// FIFO push and the modulator. The cost is one
+// sample of delay. This only moves the write; it
+// does nothing about the interrupt latency, since
+// the instruction the main loop is in the middle
+// of, and any atomic block it is in, still have
+// to finish first. How much the DAC timing varies
+// in practice has not been measured, so no jitter
+// figure is claimed here. CONFIG_AFSK_DAC_TIMING
+// makes it possible to measure it on a modem.
+static uint8_t dacNext = 128;
+
 ISR(ADC_vect) {
+    DAC_PORT = dacNext;
+    #if CONFIG_AFSK_DAC_TIMING
+        DAC_TIMING_TOGGLE();
+    #endif
     TIFR1 = _BV(ICF1);
-    AFSK_adc_isr(AFSK_modem, ((int16_t)((ADC) >> 2) - 128));
+    if (!fifo_isfull(&AFSK_modem->adcFifo)) {
+        // Remove the DC offset and apply the gain,
+        // first the shift and then the scale. At
+        // unity gain and a centered offset, this is
+        // the same as taking the top 8 bits of the
+        // ADC value. Anything that clips before the
+        // scale would clip after it too, since the
+        // scale is never below 1.0.
+        int16_t sample = ((int16_t)ADC - (int16_t)AFSK_modem->adcBias) << AFSK_modem->adcShift;
+        sample >>= 2;
+        if (sample > 127) sample = 127;
+        if (sample < -128) sample = -128;
+        sample = ((int8_t)sample * AFSK_modem->adcScale) >> AGC_SCALE_FRAC;
+        if (sample > 127) sample = 127;
+        if (sample < -128) sample = -128;
+        fifo_push(&AFSK_modem->adcFifo, (uint8_t)sample);
+    } else {
+        AFSK_modem->adcOverruns++;
+    }
     if (hw_afsk_dac_isr) {
-        DAC_PORT = (AFSK_dac_isr(AFSK_modem) & 0xF0) | _BV(3); 
+        dacNext = (AFSK_dac_isr(AFSK_modem) & 0xF0) | _BV(3);
     } else {
-        DAC_PORT = 128;
+        dacNext = 128;
     }
     ++_clock;
 }
\ No newline at end of file
@@ -2,6 +2,7 @@
 #define AFSK_H
 
 #include "device.h"
+#include "config.h"
 #include <stdint.h>
 #include <stdbool.h>
 #include <stdio.h>
@@ -9,29 +10,34 @@
 #include "util/FIFO.h"
 #include "util/time.h"
 #include "protocol/HDLC.h"
-
-#define SIN_LEN 512
-static const uint8_t sin_table[] PROGMEM =
-{
-    128, 129, 131, 132, 134, 135, 137, 138, 140, 142, 143, 145, 146, 148, 149, 151,
-    152, 154, 155, 157, 158, 160, 162, 163, 165, 166, 167, 169, 170, 172, 173, 175,
-    176, 178, 179, 181, 182, 183, 185, 186, 188, 189, 190, 192, 193, 194, 196, 197,
-    198, 200, 201, 202, 203, 205, 206, 207, 208, 210, 211, 212, 213, 214, 215, 217,
-    218, 219, 220, 221, 222, 223, 224, 225, 226, 227, 228, 229, 230, 231, 232, 233,
-    234, 234, 235, 236, 237, 238, 238, 239, 240, 241, 241, 242, 243, 243, 244, 245,
-    245, 246, 246, 247, 248, 248, 249, 249, 250, 250, 250, 251, 251, 252, 252, 252,
-    253, 253, 253, 253, 254, 254, 254, 254, 254, 255, 255, 255, 255, 255, 255, 255,
-};
-
-inline static uint8_t sinSample(uint16_t i) {
-    uint16_t newI = i % (SIN_LEN/2);
-    newI = (newI >= (SIN_LEN/4)) ? (SIN_LEN/2 - newI -1) : newI;
-    uint8_t sine = pgm_read_byte(&sin_table[newI]);
-    return (i >= (SIN_LEN/2)) ? (255 - sine) : sine;
+#include "hardware/G3RUH.h"
+
+// The tones are generated with a 16 bit phase
+// accumulator. The top SIN_BITS bits of the phase
+// index a table with one full period of the sine,
+// and the lower bits keep track of the fraction,
+// so the tone frequencies come out exact. The
+// table is generated by tools/sine_table.c.
+//
+// The table has 256 entries, which is half the
+// 512 points the old quarter-period table gave.
+// That is on purpose: only the top 4 bits of a
+// sample reach the resistor DAC, and the 4 bit
+// quantisation noise is far above the error from
+// the coarser phase. At the DAC output, both
+// tones come out at about 24-25 dB SNR with
+// either table size, while the 8 bit samples
+// themselves only go from 39-42 dB to 46 dB. The
+// smaller table also saves 256 bytes of flash.
+#define SIN_BITS 8
+#define SIN_LEN (1 << SIN_BITS)
+extern const uint8_t sin_table[SIN_LEN];
+
+inline static uint8_t sinSample(uint16_t phase) {
+    return pgm_read_byte(&sin_table[phase >> (16 - SIN_BITS)]);
 }
 
 
-#define SWITCH_TONE(inc)  (((inc) == MARK_INC) ? SPACE_INC : MARK_INC)
 #define BITS_DIFFER(bits1, bits2) (((bits1)^(bits2)) & 0x01)
 #define DUAL_XOR(bits1, bits2) ((((bits1)^(bits2)) & 0x03) == 0x03)
 #define SIGNAL_TRANSITIONED(bits) DUAL_XOR((bits), (bits) >> 2)
@@ -41,102 +47,482 @@ inline static uint8_t sinSample(uint16_t i) {
 
 #define CONFIG_AFSK_RX_BUFLEN 64
 #define CONFIG_AFSK_TX_BUFLEN 64   
+#define CONFIG_AFSK_ADC_BUFLEN 128
+#define CONFIG_AFSK_RX_BATCH 16
 #define CONFIG_AFSK_RXTIMEOUT 0
 #define CONFIG_AFSK_PREAMBLE_LEN 350UL
 #define CONFIG_AFSK_TRAILER_LEN 50UL
 #define BIT_STUFF_LEN 5
 
-#define SAMPLERATE 9600
-#define BITRATE    1200
+// Outgoing data is encoded into NRZI tone bits in
+// the main loop, and this is how many bytes of
+// encoded bits can be waiting for the DAC ISR.
+// 16 bytes is more than 100ms of audio at 1200
+// baud. At the G3RUH bitrates it is a lot less,
+// so we give the encoder some more slack there.
+#if MODULATION == MODULATION_G3RUH
+    #define CONFIG_AFSK_TXBITS_BUFLEN 32
+#else
+    #define CONFIG_AFSK_TXBITS_BUFLEN 16
+#endif
+
+// The tone bits of a HDLC flag. The ISR sends
+// these if it ever runs out of encoded bits
+// between frames.
+#define HDLC_FLAG_NRZI 0x81
+
+// If the ISR runs out of encoded bits in the
+// middle of a frame, the frame can't be saved, so
+// it sends ones instead, which is a HDLC abort,
+// and the encoder throws away the rest of the
+// frame. The encoder then also sends this many
+// bytes of ones, unstuffed. In G3RUH mode, the
+// ISR can't scramble the abort itself, so it just
+// holds the level, and the receiver's descrambler
+// needs 17 bits to get back in step afterwards.
+// There it takes 3 bytes to be sure that the
+// receiver sees at least 7 ones in a row.
+#if MODULATION == MODULATION_G3RUH
+    #define CONFIG_AFSK_ABORT_LEN 3
+#else
+    #define CONFIG_AFSK_ABORT_LEN 1
+#endif
 
-#define SAMPLESPERBIT (SAMPLERATE / BITRATE)
-#define PHASE_INC    1                              // Nudge by an eigth of a sample each adjustment
+#define SAMPLERATE CONFIG_AFSK_DAC_SAMPLERATE
 
 #define DCD_MIN_COUNT 6
-#define DCD_TIMEOUT_SAMPLES 96
-                       
-#if BITRATE == 960
-    #define FILTER_CUTOFF 600
-    #define MARK_FREQ  960
-    #define SPACE_FREQ 1600
-    #define PHASE_BITS   10                         // How much to increment phase counter each sample
-#elif BITRATE == 1200
-    #define FILTER_CUTOFF 600
-    #define MARK_FREQ  1200
-    #define SPACE_FREQ 2200
-    #define PHASE_BITS   8
-#elif BITRATE == 1600
-    #define FILTER_CUTOFF 800
-    #define MARK_FREQ  1600
-    #define SPACE_FREQ 2600
-    #define PHASE_BITS   8
+
+// DCD is dropped when a slicer has seen no
+// transitions for this many bits. The scrambled
+// G3RUH signal can go a bit longer without one
+// by chance, so it gets some more time.
+#if MODULATION == MODULATION_G3RUH
+    #define DCD_TIMEOUT_BITS 30
+#else
+    #define DCD_TIMEOUT_BITS 12
+#endif
+
+// The bitrate, tones and filters of the modem are
+// given by a profile, which can be changed at
+// runtime. The profiles are kept in a table that
+// tools/profile_table.c generates at build time,
+// with the filters designed for the sample rate.
+// All of them share the sample rate, so the timer
+// and the clock never change. The modem starts
+// out with the profile for CONFIG_AFSK_BITRATE.
+//
+// For every profile, the phase counter of the
+// slicers wraps around at samplesPerBit times
+// phaseBits, which is the resolution of the bit
+// clock. In G3RUH mode there are no tones, and
+// the bits are shaped from a table instead.
+#if MODULATION == MODULATION_G3RUH
+    #define CONFIG_AFSK_BITRATE G3RUH_BITRATE
+    #define AFSK_PROFILES 2
+    #define AFSK_MAX_SAMPLESPERBIT 8
+#elif MODULATION == MODULATION_AFSK
+    #define CONFIG_AFSK_BITRATE 1200
+    #define AFSK_PROFILES 3
+    #define AFSK_MAX_SAMPLESPERBIT 10
+#else
+    #error Unsupported modulation!
+#endif
+
+#if DCD_TIMEOUT_BITS * AFSK_MAX_SAMPLESPERBIT > 255
+    #error DCD timeout does not fit the silent sample counter!
+#endif
+
+#define TONE_INC(freq) (uint16_t)(DIV_ROUND(65536UL * (freq), SAMPLERATE))
+
+// The AFSK filters are second-order sections. The
+// numerator of the band-pass filter in front of
+// the demodulator is always 1 0 -1, and that of
+// the low-pass filter after the discriminator is
+// always 1 2 1, so they are done with shifts and
+// adds. The gain and the feedback coefficients
+// have AFSK_FILTER_FRAC bits of fraction.
+//
+// The band-pass filter keeps its output with
+// AFSK_BAND_SHIFT bits of fraction, and the
+// discriminator products are shifted right by
+// AFSK_PRODUCT_SHIFT before they are filtered,
+// which keeps all of it within 16 bits. The
+// generated table is checked against these.
+#define AFSK_FILTER_FRAC 12
+#define AFSK_BAND_SHIFT 6
+#define AFSK_PRODUCT_SHIFT 2
+
+typedef struct AfskBiquad
+{
+    int16_t b0;                             // Gain
+    int16_t a1;                             // Feedback from the previous output
+    int16_t a2;                             // Feedback from the output before that
+} AfskBiquad;
+
+typedef struct AfskProfile
+{
+    uint16_t bitrate;                       // Bits per second
+    uint8_t samplesPerBit;                  // Samples per bit at SAMPLERATE
+    uint8_t phaseBits;                      // How much to increment phase counter each sample
+#if MODULATION == MODULATION_G3RUH
+    // Transmitted bits go through a simple raised
+    // cosine shape, which keeps the spectrum inside
+    // the passband of a 9k6 data port. The shape
+    // tables are generated along with the profiles.
+    const uint8_t *shape;                   // DAC shape table for this many samples per bit
+#else
+    uint16_t markInc;                       // Phase increment per sample for the mark tone
+    uint16_t spaceInc;                      // Phase increment per sample for the space tone
+    AfskBiquad band;                        // Band-pass filter in front of the demodulator
+    AfskBiquad lowpass;                     // Low-pass filter after the discriminator
+#endif
+} AfskProfile;
+
+extern const AfskProfile afskProfiles[AFSK_PROFILES];
+
+#define SWITCH_TONE(profile, inc) (((inc) == (profile).markInc) ? (profile).spaceInc : (profile).markInc)
+
+// The bit clock is recovered by a proportional/
+// integral loop. The phase counter has PLL_FRAC_BITS
+// bits of fraction below its resolution, so small
+// corrections add up instead of being rounded
+// away. Every gain is given as a right shift of
+// the phase error.
+//
+// Until the slicer has DCD, the loop uses the wide
+// acquisition gains, so it pulls in quickly on the
+// preamble. Once DCD is declared, it switches to
+// the narrow tracking gains, so noise on single
+// transitions inside the frame moves the clock as
+// little as possible. The integral term follows
+// a difference in clock rate between us and the
+// transmitter, up to the phase step shifted right
+// by PLL_FREQ_SHIFT, which is about 0.8%.
+//
+// When the average phase error while tracking is
+// more than the size of the phase counter shifted
+// right by PLL_SLIP_SHIFT, a quarter of a bit, the
+// clock has slipped, or is about to.
+#define PLL_FRAC_BITS 8
+
+#define CONFIG_PLL_ACQ_KP   2
+#define CONFIG_PLL_ACQ_KI   6
+#define CONFIG_PLL_TRACK_KP 3
+#define CONFIG_PLL_TRACK_KI 8
+
+#define PLL_FREQ_SHIFT 7
+#define PLL_SLIP_SHIFT 2
+
+// The ADC ISR removes the DC offset of the input
+// and scales the samples by the AGC gain before
+// they go into the ADC FIFO. Both are estimated
+// in the main loop, once every AGC_BLOCK samples,
+// from the samples the ISR has produced.
+//
+// The gain has AGC_GAIN_FRAC bits of fraction. A
+// gain of 1.0 maps the full range of the 10 bit
+// ADC onto the 8 bit samples, which is what the
+// modem did before it had an AGC, so the gain is
+// never lowered below that. At the top end, the
+// gain is limited to 16 times that, which is as
+// far as the resolution of the ADC makes sense.
+//
+// So that the ISR doesn't need a 32 bit multiply,
+// the gain is split in two for it: a left shift
+// of 0 to 4 bits, applied to the ADC value, and a
+// scale of 1.0 to 2.0 with AGC_SCALE_FRAC bits of
+// fraction, applied to the 8 bit sample. That is
+// a single 8 by 8 bit multiply.
+//
+// While the peaks of a block are below
+// AGC_TARGET_LOW, the gain is raised slowly. When
+// they reach AGC_TARGET_HIGH, it is lowered, and
+// when the samples clip it is lowered quickly,
+// so a strong signal is brought down within the
+// preamble. While a frame is being received, the
+// gain is only ever lowered on clipping, so the
+// level the slicers see stays put.
+#define CONFIG_AFSK_AGC true
+
+// For measuring the timing of the DAC output.
+// When this is enabled, the ADC ISR toggles pin
+// 0 of TIMING_PIN (PB0, or D8 on Arduino boards)
+// right after it has updated the DAC. With a
+// logic analyzer on that pin, the time between
+// two edges is one sample period, and how much
+// it varies is the jitter of the DAC output.
+#define CONFIG_AFSK_DAC_TIMING false
+
+#define AGC_BLOCK 64
+#define AGC_GAIN_FRAC 8
+#define AGC_GAIN_UNITY (1 << AGC_GAIN_FRAC)
+#define AGC_GAIN_MAX (AGC_GAIN_UNITY * 16)
+#define AGC_SCALE_FRAC 7
+#define AGC_TARGET_LOW 64
+#define AGC_TARGET_HIGH 112
+#define AGC_CLIP 127
+
+// The DC offset is kept with 4 bits of fraction,
+// and starts out at the middle of the ADC range
+#define ADC_BIAS_FRAC 4
+#define ADC_BIAS_CENTER 512
+
+// Every block, the estimate moves by this right
+// shift of the offset that is left. For AFSK a
+// block holds whole periods of the tones, and an
+// eighth settles within a few tens of
+// milliseconds. A block of G3RUH holds only 16
+// scrambled bits, whose average is far from
+// zero, so there it has to move a lot slower.
+#if MODULATION == MODULATION_G3RUH
+    #define ADC_BIAS_SHIFT 7
+#else
+    #define ADC_BIAS_SHIFT 3
+#endif
+
+// In AFSK mode, the modem can find the bitrate of
+// a transmission by itself, from its preamble.
+// The flags are sent NRZI coded, so back to back
+// flags change tone after one bit, then after
+// seven, then one again, and so on. Bit stuffing
+// never lets data go seven bits without a change
+// of tone, so this pattern only shows up between
+// frames.
+//
+// A small discriminator of its own, with a delay
+// of AFSK_DETECT_DELAY samples, tells the tones of
+// all the profiles apart at 9600 Hz, so it works
+// whatever profile the demodulator is set to. The
+// time between its changes of tone is matched
+// against the flag pattern of every profile, and
+// when AFSK_DETECT_FLAGS flags in a row match a
+// profile other than the current one, and none
+// of the slicers has DCD, the demodulator switches
+// over. That happens well within the preamble, so
+// the first frame is received at the new bitrate.
+//
+// Transmissions always use the profile set by the
+// host, and the demodulator goes back to it when
+// the modem starts sending. G3RUH mode has nothing
+// like this, since the flags are scrambled.
+#if MODULATION == MODULATION_AFSK
+    #define CONFIG_AFSK_AUTOPROFILE true
 #else
-    #error Unsupported bitrate!
+    #define CONFIG_AFSK_AUTOPROFILE false
 #endif
 
-#define PHASE_MAX    (SAMPLESPERBIT * PHASE_BITS)   // Resolution of our phase counter = 64
-#define PHASE_THRESHOLD  (PHASE_MAX / 2)            // Target transition point of our phase window
+#define AFSK_DETECT_DELAY 5
+#define AFSK_DETECT_BUFLEN 8
+#define AFSK_DETECT_FLAGS 3
+
+#if AFSK_DETECT_DELAY >= AFSK_DETECT_BUFLEN || (AFSK_DETECT_BUFLEN & (AFSK_DETECT_BUFLEN - 1)) != 0
+    #error Invalid detector buffer length!
+#endif
+
+// The delay line for the discriminator needs room
+// for half a bit worth of samples, while the
+// correlator keeps a full bit worth of samples to
+// slide its window along. Like all the other
+// FIFOs its size must be a power of two, and it
+// must fit the profile with the most samples per
+// bit. G3RUH mode has no need for it.
+#if MODULATION == MODULATION_AFSK
+    #if AFSK_DEMODULATOR == AFSK_DEMOD_CORRELATOR
+        #define AFSK_DELAY_SAMPLES(samplesPerBit) (samplesPerBit)
+    #else
+        #define AFSK_DELAY_SAMPLES(samplesPerBit) ((samplesPerBit) / 2)
+    #endif
+
+    #if AFSK_DELAY_SAMPLES(AFSK_MAX_SAMPLESPERBIT) > 8
+        #define CONFIG_AFSK_DELAY_BUFLEN 16
+    #else
+        #define CONFIG_AFSK_DELAY_BUFLEN 8
+    #endif
+
+    #if !FIFO_SIZE_VALID(CONFIG_AFSK_DELAY_BUFLEN) || CONFIG_AFSK_DELAY_BUFLEN < AFSK_DELAY_SAMPLES(AFSK_MAX_SAMPLESPERBIT)
+        #error Delay buffer is too small for the slowest profile!
+    #endif
+#endif
+
+// The demodulator output can be sliced into bits
+// by several slicers at once, each with its own
+// decision threshold, bit clock and HDLC deframer.
+// When the audio has twist between the tones, the
+// best threshold is no longer zero, and one of
+// the offset slicers will often decode a frame the
+// centred one loses. The LLP receiver keeps one
+// frame buffer per slicer, so the 328p only has
+// RAM for a single one. The baseband G3RUH signal
+// has no twist, and there is no time for more
+// than one slicer at its sample rate anyway. The
+// host tests set the number of slicers themselves,
+// so the multi-slicer code is built and tested
+// even though the 328p can't use it.
+#ifndef CONFIG_AFSK_SLICERS
+    #if TARGET_CPU == m328p || MODULATION == MODULATION_G3RUH
+        #define CONFIG_AFSK_SLICERS 1
+    #else
+        #define CONFIG_AFSK_SLICERS 3
+    #endif
+#endif
+
+#if CONFIG_AFSK_SLICERS < 1 || CONFIG_AFSK_SLICERS > 4
+    #error Unsupported number of AFSK slicers!
+#endif
+
+#if !FIFO_SIZE_VALID(CONFIG_AFSK_RX_BUFLEN) || !FIFO_SIZE_VALID(CONFIG_AFSK_TX_BUFLEN) || !FIFO_SIZE_VALID(CONFIG_AFSK_ADC_BUFLEN) || !FIFO_SIZE_VALID(CONFIG_AFSK_TXBITS_BUFLEN)
+    #error AFSK buffer sizes must be powers of two, no larger than FIFO_MAX_SIZE!
+#endif
 
 typedef struct Hdlc
 {
-    uint8_t demodulatedBits;
+    uint8_t demodulatedBits;                // Demodulated bits waiting to be parsed
+    uint8_t demodulatedWeak;                // Which of them the demodulator was unsure about
+    uint8_t demodulatedCount;               // Number of bits waiting to be parsed
+    uint8_t ones;                           // Deframer state, consecutive ones received
     uint8_t bitIndex;
     uint8_t currentByte;
+    uint8_t currentWeak;                    // Weak bits of the current byte
     bool receiving;
     bool dcd;
     uint8_t dcd_count;
 } Hdlc;
 
+typedef struct AfskSlicer
+{
+    Hdlc hdlc;                              // Every slicer has its own link control structure
+    uint8_t sampledBits;                    // Bits sampled by the demodulator (at ADC speed)
+    int16_t currentPhase;                   // Current phase of the demodulator, with PLL_FRAC_BITS of fraction
+    int16_t phaseDrift;                     // Integral term of the PLL, added to the phase every sample
+    int16_t phaseError;                     // Average phase error while tracking
+    uint16_t lockBits;                      // Bits since the first flag, while waiting for DCD
+    uint8_t actualBits;                     // Actual found bits at correct bitrate
+    uint8_t actualWeak;                     // Which of them were weak
+    uint8_t silentSamples;                  // How many samples had no transitions
+#if MODULATION == MODULATION_G3RUH
+    uint32_t descrambler;                   // Last received line bits, before descrambling
+    uint32_t descramblerWeak;               // Which of them were weak
+#endif
+
+    FIFOBuffer rxFifo;                      // FIFO for received data
+    uint8_t rxBuf[CONFIG_AFSK_RX_BUFLEN];   // Actual data storage for said FIFO
+} AfskSlicer;
+
 typedef struct Afsk
 {
     // Stream access to modem
     FILE fd;
 
     // General values
-    Hdlc hdlc;                              // We need a link control structure
     uint16_t preambleLength;                // Length of sync preamble
     uint16_t tailLength;                    // Length of transmission tail
 
+    // Modem profile
+    AfskProfile profile;                    // Current modem profile
+    uint8_t profileIndex;                   // Its index in the profile table
+    uint8_t txProfile;                      // Profile set by the host, always used for sending
+    int16_t pllPhaseMax;                    // Size of the slicer phase counter, with PLL_FRAC_BITS of fraction
+    int16_t pllPhaseStep;                   // Phase counter increment per sample, likewise
+    uint8_t dcdTimeout;                     // Samples without transitions before DCD is dropped
+
     // Modulation values
     uint8_t sampleIndex;                    // Current sample index for outgoing bit 
-    uint8_t currentOutputByte;              // Current byte to be modulated
-    uint8_t txBit;                          // Mask of current modulated bit
-    bool bitStuff;                          // Whether bitstuffing is allowed
+    uint8_t txBits;                         // Tone bits currently being modulated
+    uint8_t txBitsLeft;                     // How many of them are left
 
+    // Encoder values
+    bool bitStuff;                          // Whether bitstuffing is allowed
     uint8_t bitstuffCount;                  // Counter for bit-stuffing
-
+    uint16_t encodedBits;                   // Tone bits waiting to be pushed to the bit FIFO
+    uint8_t encodedCount;                   // Number of bits waiting
+    volatile bool txDone;                   // Set when everything has been encoded
+    volatile bool txInFrame;                // Set while the encoder is in the middle of a frame
+    volatile bool txUnderrun;               // Set by the ISR when it ran out of bits in a frame
+    bool txDropping;                        // Set while the rest of an aborted frame is dropped
+    uint8_t abortLength;                    // Bytes of the abort left to encode
+    uint16_t txUnderruns;                   // Frames aborted because the encoder fell behind
+
+    FIFOBuffer txBitFifo;                   // Encoded tone bits, 1 means switch tone
+    uint8_t txBitBuf[CONFIG_AFSK_TXBITS_BUFLEN];  // Actual data storage for said FIFO
+
+#if MODULATION == MODULATION_G3RUH
+    uint8_t nrziLevel;                      // Line level before scrambling, kept by the encoder
+    uint32_t scrambler;                     // Last scrambled line bits, kept by the encoder
+    uint8_t txShape;                        // Previous, current and next line level, see AFSK_dac_isr
+#else
     uint16_t phaseAcc;                      // Phase accumulator
     uint16_t phaseInc;                      // Phase increment per sample
-
-    uint8_t silentSamples;                 // How many samples were completely silent
+#endif
 
     FIFOBuffer txFifo;                      // FIFO for transmit data
     uint8_t txBuf[CONFIG_AFSK_TX_BUFLEN];   // Actual data storage for said FIFO
 
     volatile bool sending;                  // Set when modem is sending
-    volatile bool sending_data;             // Set when modem is sending data
 
     // Demodulation values
+    FIFOBuffer adcFifo;                     // FIFO for raw samples captured by the ADC ISR
+    int8_t adcBuf[CONFIG_AFSK_ADC_BUFLEN];  // Actual data storage for said FIFO
+    volatile uint16_t adcOverruns;          // Samples dropped because the ADC FIFO was full
+    volatile uint16_t adcBias;              // DC offset removed by the ADC ISR, in ADC counts
+    uint16_t adcGain;                       // AGC gain, with AGC_GAIN_FRAC of fraction
+    volatile uint8_t adcShift;              // Left shift the ADC ISR applies for the gain
+    volatile uint8_t adcScale;              // Scale the ADC ISR applies after it, with AGC_SCALE_FRAC of fraction
+    int16_t biasEstimate;                   // DC offset estimate, with ADC_BIAS_FRAC of fraction
+    int16_t agcSum;                         // Sum of the samples in the current AGC block
+    uint8_t agcPeak;                        // Largest sample size in the current AGC block
+    uint8_t agcCount;                       // Samples in the current AGC block
+    uint16_t inputLevel;                    // Peak level of the input in ADC counts, last block
+    uint16_t pllLockTime;                   // Bits from the first flag to DCD, last time a slicer locked
+    uint16_t pllSlips;                      // Bit slips seen by the slicers while tracking
+
+#if MODULATION == MODULATION_G3RUH
+    int8_t lastSample[2];                   // Previous samples, for the receive filter
+#else
+    int8_t bandX[2];                        // Band-pass filter input cells
+    int16_t bandY[2];                       // Band-pass filter output cells
     FIFOBuffer delayFifo;                   // Delayed FIFO for frequency discrimination
-    int8_t delayBuf[SAMPLESPERBIT / 2 + 1]; // Actual data storage for said FIFO
-
-    FIFOBuffer rxFifo;                      // FIFO for received data
-    uint8_t rxBuf[CONFIG_AFSK_RX_BUFLEN];   // Actual data storage for said FIFO
+    int8_t delayBuf[CONFIG_AFSK_DELAY_BUFLEN]; // Actual data storage for said FIFO
+#endif
 
+#if MODULATION == MODULATION_G3RUH
+    // The baseband signal needs no filter state
+    // beyond the previous samples
+#elif AFSK_DEMODULATOR == AFSK_DEMOD_CORRELATOR
+    uint16_t markPhase;                     // Phase of the mark reference tone
+    uint16_t spacePhase;                    // Phase of the space reference tone
+    int16_t markI;                          // Sliding mark correlator sums
+    int16_t markQ;
+    int16_t spaceI;                         // Sliding space correlator sums
+    int16_t spaceQ;
+#else
     int16_t iirX[2];                        // IIR Filter X cells
     int16_t iirY[2];                        // IIR Filter Y cells
+#endif
 
-    uint8_t sampledBits;                    // Bits sampled by the demodulator (at ADC speed)
-    int8_t currentPhase;                    // Current phase of the demodulator
-    uint8_t actualBits;                     // Actual found bits at correct bitrate
+    AfskSlicer slicers[CONFIG_AFSK_SLICERS]; // Slicers turning the demodulator output into bits
+#if CONFIG_AFSK_SLICERS > 1
+    int16_t level;                          // Average size of the demodulator output
+#endif
+
+#if CONFIG_AFSK_AUTOPROFILE
+    // Bitrate detection
+    int8_t detectBuf[AFSK_DETECT_BUFLEN];   // Recent samples, for the detector's discriminator
+    uint8_t detectIndex;                    // Where the next sample goes in detectBuf
+    int16_t detectX;                        // Previous discriminator product
+    int16_t detectY;                        // Filtered discriminator output
+    bool detectTone;                        // Which side of zero the output was on
+    uint8_t detectRun;                      // Samples since the tone last changed
+    uint8_t detectLastRun;                  // Samples between the two changes before that
+    uint8_t detectRuns;                     // Runs since the last flag
+    uint8_t detectProfile;                  // Profile the last flag matched
+    uint8_t detectCount;                    // Flags in a row that matched it
+#endif
 
     volatile int status;                    // Status of the modem, 0 means OK
 
 } Afsk;
 
 #define DIV_ROUND(dividend, divisor)  (((dividend) + (divisor) / 2) / (divisor))
-#define MARK_INC   (uint16_t)(DIV_ROUND(SIN_LEN * (uint32_t)MARK_FREQ, CONFIG_AFSK_DAC_SAMPLERATE))
-#define SPACE_INC  (uint16_t)(DIV_ROUND(SIN_LEN * (uint32_t)SPACE_FREQ, CONFIG_AFSK_DAC_SAMPLERATE))
 
 #define AFSK_DAC_IRQ_START()   do { extern bool hw_afsk_dac_isr; hw_afsk_dac_isr = true; } while (0)
 #define AFSK_DAC_IRQ_STOP()    do { extern bool hw_afsk_dac_isr; hw_afsk_dac_isr = false; } while (0)
@@ -155,8 +541,18 @@ typedef struct Afsk
 #define LED_RX_ON()   do { LED_PORT |= _BV(2); } while (0)
 #define LED_RX_OFF()  do { LED_PORT &= ~_BV(2); } while (0)
 
+#define DAC_TIMING_INIT()   do { TIMING_DDR |= _BV(0); } while (0)
+#define DAC_TIMING_TOGGLE() do { TIMING_PIN = _BV(0); } while (0)
+
 void AFSK_init(Afsk *afsk);
-void AFSK_transmit(char *buffer, size_t size);
+size_t AFSK_transmit(char *buffer, size_t size);
 void AFSK_poll(Afsk *afsk);
 
+size_t afsk_write(Afsk *afsk, const uint8_t *buf, size_t len);
+uint8_t afsk_readspan(Afsk *afsk, uint8_t slicer, const uint8_t **span);
+void afsk_skip(Afsk *afsk, uint8_t slicer, uint8_t n);
+bool AFSK_receiving(Afsk *afsk);
+bool AFSK_setProfile(Afsk *afsk, uint8_t index);
+uint16_t AFSK_profileBitrate(uint8_t index);
+
 #endif
\ No newline at end of file
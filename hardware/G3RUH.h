@@ -0,0 +1,37 @@
+#ifndef HARDWARE_G3RUH_H
+#define HARDWARE_G3RUH_H
+
+#include <stdint.h>
+
+// G3RUH mode scrambles the NRZI line bits with
+// the polynomial x^17 + x^12 + 1, which keeps the
+// signal free of DC and long runs without
+// transitions. The descrambler in the receiver
+// synchronises by itself after 17 bits.
+//
+// This header has no dependencies on the rest of
+// the firmware, so the host test in
+// tools/scrambler_test.c uses it as it is.
+#define G3RUH_TAP_A 11
+#define G3RUH_TAP_B 16
+#define G3RUH_SCRAMBLE(state) ((((state) >> G3RUH_TAP_A) ^ ((state) >> G3RUH_TAP_B)) & 0x01)
+
+// Scrambles one line level, and returns the
+// level to send. The state holds the last sent
+// levels.
+static inline uint8_t g3ruh_scramble(uint32_t *state, uint8_t level) {
+    level ^= G3RUH_SCRAMBLE(*state);
+    *state = (*state << 1) | level;
+    return level;
+}
+
+// Descrambles one received line level. The state
+// holds the last received levels, so a wrong one
+// ends up in this and the two tapped bits after it.
+static inline uint8_t g3ruh_descramble(uint32_t *state, uint8_t line) {
+    uint8_t level = line ^ G3RUH_SCRAMBLE(*state);
+    *state = (*state << 1) | line;
+    return level;
+}
+
+#endif
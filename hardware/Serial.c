@@ -1,10 +1,23 @@
 #include "Serial.h"
 #include <util/setbaud.h>
+#include <avr/pgmspace.h>
 #include <stdio.h>
 #include <string.h>
 
+Serial *serial0;
+
+static const uint32_t serial_baudrates[SERIAL_BAUD_COUNT] PROGMEM = {
+    9600, 19200, 38400, 57600, 115200, 250000, 500000, 1000000
+};
+
 void serial_init(Serial *serial) {
     memset(serial, 0, sizeof(*serial));
+    serial0 = serial;
+
+    fifo_init(&serial->rxFifo, serial->rxBuf, sizeof(serial->rxBuf));
+    fifo_init(&serial->txFifo, serial->txBuf, sizeof(serial->txBuf));
+
+    serial->baud = BAUD;
     UBRR0H = UBRRH_VALUE;
     UBRR0L = UBRRL_VALUE;
 
@@ -14,9 +27,11 @@ void serial_init(Serial *serial) {
         UCSR0A &= ~(_BV(U2X0));
     #endif
 
-    // Set to 8-bit data, enable RX and TX
+    // Set to 8-bit data, enable RX and TX, and
+    // the RX complete interrupt. The UDRE interrupt
+    // is only enabled while we have data to send.
     UCSR0C = _BV(UCSZ01) | _BV(UCSZ00);
-    UCSR0B = _BV(RXEN0) | _BV(TXEN0);
+    UCSR0B = _BV(RXEN0) | _BV(TXEN0) | _BV(RXCIE0);
 
     FILE uart0_fd = FDEV_SETUP_STREAM(uart0_putchar, uart0_getchar, _FDEV_SETUP_RW);
     //FILE uart0_fd = FDEV_SETUP_STREAM(uart0_putchar, NULL, _FDEV_SETUP_WRITE);
@@ -24,26 +39,126 @@ void serial_init(Serial *serial) {
     serial->uart0 = uart0_fd;
 }
 
+// Clears the transmit complete flag, so it will
+// only be set again when everything we have queued
+// has left the USART, and enables the UDRE interrupt.
+static void serial_startTx(Serial *serial) {
+    UCSR0A = (UCSR0A & _BV(U2X0)) | _BV(TXC0);
+    serial->txPending = true;
+    UCSR0B |= _BV(UDRIE0);
+}
+
 bool serial_available(uint8_t index) {
     if (index == 0) {
-        if (UCSR0A & _BV(RXC0)) return true;
+        if (!fifo_isempty(&serial0->rxFifo)) return true;
     }
     return false;
 }
 
+// Queues as much of the data as there is room
+// for in the TX buffer, and returns how much
+// that was. Never waits for the USART. While a
+// baudrate change is waiting for the TX buffer
+// to drain, nothing more is queued, since it
+// would be sent at the wrong rate.
+size_t serial_write(Serial *serial, const uint8_t *data, size_t len) {
+    if (serial->pendingBaud) return 0;
+
+    size_t written = 0;
+    while (written < len) {
+        size_t n = len - written;
+        if (n > FIFO_MAX_SIZE) n = FIFO_MAX_SIZE;
+        n = fifo_push_n(&serial->txFifo, data + written, n);
+        if (n == 0) break;
+        written += n;
+    }
+    if (written) serial_startTx(serial);
+    return written;
+}
+
+// Returns the baudrate for one of the SERIAL_BAUD
+// codes, or 0 if the code is not supported.
+uint32_t serial_baudrate(uint8_t code) {
+    if (code >= SERIAL_BAUD_COUNT) return 0;
+    return pgm_read_dword(&serial_baudrates[code]);
+}
+
+// Changes the baudrate at runtime. Anything that
+// is already queued is sent at the old rate
+// first, so this only records the new rate, and
+// serial_poll makes the switch once the USART
+// has sent the last byte. We always use double
+// speed mode here, since that is what makes the
+// high rates reachable from a 16MHz clock.
+void serial_setbaud(Serial *serial, uint32_t baud) {
+    serial->pendingBaud = baud;
+}
+
+// Called regularly from the main loop, to carry
+// out a baudrate change when its time has come
+void serial_poll(Serial *serial) {
+    if (serial->pendingBaud == 0 || !fifo_isempty(&serial->txFifo)) return;
+    if (serial->txPending) {
+        if (bit_is_clear(UCSR0A, TXC0)) return;
+        serial->txPending = false;
+    }
 
+    uint32_t baud = serial->pendingBaud;
+    uint16_t ubrr = (F_CPU + 4UL * baud) / (8UL * baud) - 1;
+    UBRR0H = ubrr >> 8;
+    UBRR0L = ubrr & 0xFF;
+    UCSR0A |= _BV(U2X0);
+
+    serial->baud = baud;
+    serial->pendingBaud = 0;
+}
+
+// Reads whatever is waiting in the RX buffer,
+// up to len bytes, and returns how much that was.
+size_t serial_read(Serial *serial, uint8_t *data, size_t len) {
+    if (len > FIFO_MAX_SIZE) len = FIFO_MAX_SIZE;
+    return fifo_pop_n(&serial->rxFifo, data, len);
+}
+
+// The stdio stream functions never wait either.
+// If the TX buffer is full, the character is not
+// sent and stdio sees an error, and reading with
+// nothing received gives EOF.
 int uart0_putchar(char c, FILE *stream) {
-    loop_until_bit_is_set(UCSR0A, UDRE0);
-    UDR0 = c;
-    return 1;
+    return uart0_putchar_nowait(c) ? 0 : EOF;
 }
 
 int uart0_getchar(FILE *stream) {
-    loop_until_bit_is_set(UCSR0A, RXC0);
-    return UDR0;
+    if (fifo_isempty(&serial0->rxFifo)) return EOF;
+    return fifo_pop(&serial0->rxFifo);
+}
+
+bool uart0_putchar_nowait(char c) {
+    if (serial0->pendingBaud || fifo_isfull(&serial0->txFifo)) return false;
+    fifo_push(&serial0->txFifo, c);
+    serial_startTx(serial0);
+    return true;
 }
 
 char uart0_getchar_nowait(void) {
-    if (!(UCSR0A & _BV(RXC0))) return EOF;
-    return UDR0;
-}
\ No newline at end of file
+    if (fifo_isempty(&serial0->rxFifo)) return EOF;
+    return fifo_pop(&serial0->rxFifo);
+}
+
+ISR(SERIAL_RX_vect) {
+    if (UCSR0A & _BV(DOR0)) serial0->rxOverruns++;
+    uint8_t c = UDR0;
+    if (!fifo_isfull(&serial0->rxFifo)) {
+        fifo_push(&serial0->rxFifo, c);
+    } else {
+        serial0->rxOverflows++;
+    }
+}
+
+ISR(SERIAL_UDRE_vect) {
+    if (fifo_isempty(&serial0->txFifo)) {
+        UCSR0B &= ~_BV(UDRIE0);
+    } else {
+        UDR0 = fifo_pop(&serial0->txFifo);
+    }
+}
@@ -6,15 +6,71 @@
 #include <stdio.h>
 #include <stdbool.h>
 #include <avr/io.h>
+#include <avr/interrupt.h>
+#include "util/FIFO.h"
+
+// Sizes of the ring buffers between the USART
+// interrupts and the main loop. Like all FIFOs
+// they must be powers of two.
+#if TARGET_CPU == m328p
+    #define CONFIG_SERIAL_RX_BUFLEN 64
+    #define CONFIG_SERIAL_TX_BUFLEN 64
+#else
+    #define CONFIG_SERIAL_RX_BUFLEN 128
+    #define CONFIG_SERIAL_TX_BUFLEN 128
+#endif
+
+#if !FIFO_SIZE_VALID(CONFIG_SERIAL_RX_BUFLEN) || !FIFO_SIZE_VALID(CONFIG_SERIAL_TX_BUFLEN)
+    #error Serial buffer sizes must be powers of two, no larger than FIFO_MAX_SIZE!
+#endif
+
+#if TARGET_CPU == m328p
+    #define SERIAL_RX_vect   USART_RX_vect
+    #define SERIAL_UDRE_vect USART_UDRE_vect
+#else
+    #define SERIAL_RX_vect   USART0_RX_vect
+    #define SERIAL_UDRE_vect USART0_UDRE_vect
+#endif
+
+// Baudrates that can be selected at runtime.
+// With U2X enabled, 250k, 500k and 1M divide a
+// 16MHz clock exactly, and 115200 is within 2.1%.
+#define SERIAL_BAUD_9600    0x00
+#define SERIAL_BAUD_19200   0x01
+#define SERIAL_BAUD_38400   0x02
+#define SERIAL_BAUD_57600   0x03
+#define SERIAL_BAUD_115200  0x04
+#define SERIAL_BAUD_250000  0x05
+#define SERIAL_BAUD_500000  0x06
+#define SERIAL_BAUD_1000000 0x07
+#define SERIAL_BAUD_COUNT   8
 
 typedef struct Serial {
     FILE uart0;
+
+    FIFOBuffer rxFifo;                          // Bytes received by the RX interrupt
+    uint8_t rxBuf[CONFIG_SERIAL_RX_BUFLEN];
+    FIFOBuffer txFifo;                          // Bytes waiting for the UDRE interrupt
+    uint8_t txBuf[CONFIG_SERIAL_TX_BUFLEN];
+
+    volatile uint16_t rxOverflows;              // Bytes dropped because rxFifo was full
+    volatile uint16_t rxOverruns;               // Bytes lost in the USART itself
+
+    uint32_t baud;                              // Current baudrate
+    uint32_t pendingBaud;                       // Baudrate to switch to once TX is done, or 0
+    bool txPending;                             // Data has been sent since TXC0 was cleared
 } Serial;
 
 void serial_init(Serial *serial);
 bool serial_available(uint8_t index);
+size_t serial_write(Serial *serial, const uint8_t *data, size_t len);
+size_t serial_read(Serial *serial, uint8_t *data, size_t len);
+void serial_setbaud(Serial *serial, uint32_t baud);
+void serial_poll(Serial *serial);
+uint32_t serial_baudrate(uint8_t code);
 int uart0_putchar(char c, FILE *stream);
 int uart0_getchar(FILE *stream);
+bool uart0_putchar_nowait(char c);
 char uart0_getchar_nowait(void);
 
-#endif
\ No newline at end of file
+#endif
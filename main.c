@@ -6,6 +6,7 @@
 #include "config.h"
 #include "util/FIFO.h"
 #include "util/time.h"
+#include "util/scheduler.h"
 #include "hardware/AFSK.h"
 #include "hardware/Serial.h"
 #include "protocol/AX25.h"
@@ -18,8 +19,25 @@ Afsk modem;
 LLPAddress localAdress;
 LLPCtx llp;
 
-static void llp_callback(struct LLPCtx *ctx) {
-    kiss_messageCallback(ctx);
+static void llp_callback(struct LLPCtx *ctx, const struct LLPMsg *msg) {
+    kiss_messageCallback(ctx, msg);
+}
+
+static void modem_task(void) {
+    AFSK_poll(&modem);
+}
+
+static void llp_task(void) {
+    llp_poll(&llp);
+}
+
+// Stops everything with both LEDs lit. This is
+// only used if the modem can't start properly.
+static void halt(void) {
+    cli();
+    LED_TX_ON();
+    LED_RX_ON();
+    while (true);
 }
 
 void init(void) {
@@ -30,29 +48,28 @@ void init(void) {
     memset(&localAdress, 0, sizeof(localAdress));
     localAdress.network = LLP_ADDR_BROADCAST;
     localAdress.host    = LLP_ADDR_BROADCAST;
-    llp_init(&llp, &localAdress, &modem.fd, llp_callback);
+    llp_init(&llp, &localAdress, &modem, llp_callback);
 
     serial_init(&serial);    
     stdout = &serial.uart0;
     stdin  = &serial.uart0;
 
-    kiss_init(&llp, &modem, &serial);
+    // The modem and protocol tasks are added first,
+    // so they always run before the KISS tasks.
+    if (sched_add(modem_task) == TASK_NONE ||
+        sched_add(llp_task) == TASK_NONE ||
+        sched_add(kiss_serialPoll) == TASK_NONE ||
+        !kiss_init(&llp, &modem, &serial)) {
+        halt();
+    }
 }
 
 int main (void) {
     init();
 
-    while (true) {
-        llp_poll(&llp);
-        
-        if (serial_available(0)) {
-            char sbyte = uart0_getchar_nowait();
-            kiss_serialCallback(sbyte);
-        }
-        #if SERIAL_FRAMING == SERIAL_FRAMING_DIRECT
-            kiss_checkTimeout(false);
-        #endif
-    }
+    // Everything from here on happens in the
+    // scheduler tasks
+    sched_run();
 
     return(0);
 }
\ No newline at end of file
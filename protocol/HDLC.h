@@ -1,8 +1,50 @@
 #ifndef PROTOCOL_HDLC_H
 #define PROTOCOL_HDLC_H
 
+#include <stdint.h>
+#include <avr/pgmspace.h>
+
 #define HDLC_FLAG  0x7E
 #define HDLC_RESET 0x7F
 #define LLP_ESC   0x1B
 
-#endif
\ No newline at end of file
+// In the received data, a byte with any weak bits
+// is preceded by LLP_SOFT and a mask of the weak
+// bits, so the protocol layer can use them for
+// soft-decision decoding. Like the other control
+// characters, LLP_SOFT is escaped when it appears
+// as data. It is never sent on the air.
+#define LLP_SOFT  0x1C
+
+// The receive deframer keeps track of how many
+// consecutive ones it has seen (0-7, where 7
+// means we are in an abort sequence), and
+// decodes 8 demodulated bits at a time with a
+// single lookup in hdlc_rx_table. The table is
+// generated at build time by tools/hdlc_table.c
+#define HDLC_RX_STATES 8
+
+#define HDLC_EVENT_NONE  0x00
+#define HDLC_EVENT_FLAG  0x01
+#define HDLC_EVENT_ABORT 0x02
+#define HDLC_EVENT_MULTI 0x03       // More than one event, decode bit by bit
+
+// Each entry also has a mask of which of the 8
+// received bits ended up as data bits, so the
+// weak bits can be destuffed the same way as the
+// data. With four bytes, the entries are also
+// quicker to index than with three.
+typedef struct HdlcRxEntry {
+    uint8_t bits;                   // Destuffed data bits, earliest bit in LSB
+    uint8_t count;                  // Number of valid data bits
+    uint8_t ctrl;                   // Next state, event and event position
+    uint8_t keep;                   // Received bits that are data bits
+} HdlcRxEntry;
+
+#define HDLC_RX_ONES(ctrl)  ((ctrl) & 0x07)
+#define HDLC_RX_EVENT(ctrl) (((ctrl) >> 3) & 0x03)
+#define HDLC_RX_SPLIT(ctrl) ((ctrl) >> 5)   // Data bits that came before the event
+
+extern const HdlcRxEntry hdlc_rx_table[HDLC_RX_STATES][256];
+
+#endif
@@ -4,7 +4,49 @@
 #include "device.h"
 #include "KISS.h"
 
-static uint8_t serialBuffer[LLP_MAX_DATA_SIZE]; // Buffer for holding incoming serial data
+#define POOL_NONE 0xFF
+
+// Frames from the host are stored in a pool of
+// fixed size blocks, chained together by the
+// poolNext table. That way a burst of small frames
+// can be queued in the same memory that would
+// otherwise only hold one large frame.
+static uint8_t pool[CONFIG_KISS_POOL_BLOCKS][CONFIG_KISS_BLOCK_SIZE];
+static uint8_t poolNext[CONFIG_KISS_POOL_BLOCKS];
+static uint8_t poolFree;
+static uint8_t poolFreeCount;
+
+typedef struct KissFrame {
+    uint8_t block;                      // First block of the frame
+    size_t len;                         // Length of the frame
+} KissFrame;
+
+static KissFrame queue[CONFIG_KISS_QUEUE_LEN];  // Frames waiting to be transmitted
+static uint8_t queueHead;
+static uint8_t queueCount;
+uint8_t droppedFrames;                  // Frames dropped because the pool or queue was full
+
+static uint8_t rxBlock = POOL_NONE;     // First block of the frame we are receiving
+static uint8_t rxLast = POOL_NONE;      // Block we are currently writing to
+static bool rxDropped;                  // The frame we are receiving didn't fit
+
+#if SERIAL_FRAMING != SERIAL_FRAMING_DIRECT
+    static uint8_t cmdBuffer[KISS_CMD_BUFLEN];  // Arguments for commands other than data
+    static uint8_t cmd_len;
+#endif
+
+#define KISS_TX_IDLE    0x00
+#define KISS_TX_SENDING 0x01
+
+static uint8_t txState = KISS_TX_IDLE;
+static uint8_t txHeader[LLP_MAX_HEADER_LENGTH];
+static uint8_t txHeaderLen;
+static uint8_t txHeaderSent;
+static uint8_t txBlock;
+static size_t txSent;
+static task_t csmaTask = TASK_NONE;
+static task_t outputTask = TASK_NONE;
+
 LLPCtx *llpCtx;
 Afsk *channel;
 Serial *serial;
@@ -21,113 +63,641 @@ unsigned long slotTime = 200;
 uint8_t p = 255;
 ticks_t timeout_ticks;
 
-void kiss_init(LLPCtx *ctx, Afsk *afsk, Serial *ser) {
+uint32_t fallbackBaud = 0;
+ticks_t baud_ticks;
+
+#if SERIAL_FRAMING == SERIAL_FRAMING_BINARY
+    #define BINARY_STATE_SYNC    0x00
+    #define BINARY_STATE_HEADER  0x01
+    #define BINARY_STATE_PAYLOAD 0x02
+    #define BINARY_STATE_CRC     0x03
+
+    uint8_t binaryState = BINARY_STATE_SYNC;
+    uint8_t binaryHeader[BINARY_HEADER_SIZE];
+    uint8_t binaryCount;
+    size_t binaryLength;
+    size_t binaryReceived;
+    uint16_t binaryCrc;
+#endif
+
+static void pool_init(void) {
+    for (uint8_t i = 0; i < CONFIG_KISS_POOL_BLOCKS; i++) {
+        poolNext[i] = i + 1;
+    }
+    poolNext[CONFIG_KISS_POOL_BLOCKS - 1] = POOL_NONE;
+    poolFree = 0;
+    poolFreeCount = CONFIG_KISS_POOL_BLOCKS;
+}
+
+static uint8_t pool_alloc(void) {
+    uint8_t block = poolFree;
+    if (block != POOL_NONE) {
+        poolFree = poolNext[block];
+        poolNext[block] = POOL_NONE;
+        poolFreeCount--;
+    }
+    return block;
+}
+
+// Returns a whole chain of blocks to the pool
+static void pool_release(uint8_t block) {
+    while (block != POOL_NONE) {
+        uint8_t next = poolNext[block];
+        poolNext[block] = poolFree;
+        poolFree = block;
+        poolFreeCount++;
+        block = next;
+    }
+}
+
+static void kiss_timeoutTask(void);
+static void kiss_outputTask(void);
+
+// Returns false if the scheduler had no room for
+// the KISS tasks, which the modem can't run without
+bool kiss_init(LLPCtx *ctx, Afsk *afsk, Serial *ser) {
     llpCtx = ctx;
     serial = ser;
     channel = afsk;
     FLOWCONTROL = false;
+    pool_init();
+
+    outputTask = sched_add(kiss_outputTask);
+    csmaTask = sched_add(kiss_csma);
+    return outputTask != TASK_NONE && csmaTask != TASK_NONE &&
+           sched_add(kiss_timeoutTask) != TASK_NONE;
+}
+
+// Throws away whatever we have of the frame
+// currently being received from the host
+static void kiss_dropFrame(void) {
+    pool_release(rxBlock);
+    rxBlock = rxLast = POOL_NONE;
+    rxDropped = false;
+    frame_len = 0;
+}
+
+// Returns a pointer to where the next bytes of the
+// frame being received should go, and how many
+// bytes there is room for there. A new block is
+// taken from the pool when the current one is full.
+// Returns NULL if the frame is already as long as
+// it can be, or if the pool is empty.
+static uint8_t *kiss_reserve(size_t *room) {
+    if (rxDropped || frame_len >= LLP_MAX_DATA_SIZE) return NULL;
+
+    uint8_t offset = frame_len % CONFIG_KISS_BLOCK_SIZE;
+    if (offset == 0) {
+        uint8_t block = pool_alloc();
+        if (block == POOL_NONE) {
+            rxDropped = true;
+            return NULL;
+        }
+        if (rxLast == POOL_NONE) {
+            rxBlock = block;
+        } else {
+            poolNext[rxLast] = block;
+        }
+        rxLast = block;
+    }
+
+    *room = CONFIG_KISS_BLOCK_SIZE - offset;
+    if (*room > LLP_MAX_DATA_SIZE - frame_len) *room = LLP_MAX_DATA_SIZE - frame_len;
+    return &pool[rxLast][offset];
+}
+
+static void kiss_append(uint8_t sbyte) {
+    size_t room;
+    uint8_t *dst = kiss_reserve(&room);
+    if (dst) {
+        *dst = sbyte;
+        frame_len++;
+    }
+}
+
+// Puts the frame we have received from the host
+// in the transmit queue, if there is room for it
+static void kiss_endFrame(void) {
+    if (frame_len > 0) {
+        if (!rxDropped && queueCount < CONFIG_KISS_QUEUE_LEN) {
+            KissFrame *frame = &queue[(queueHead + queueCount) % CONFIG_KISS_QUEUE_LEN];
+            frame->block = rxBlock;
+            frame->len = frame_len;
+            queueCount++;
+            sched_wake(csmaTask);
+
+            rxBlock = rxLast = POOL_NONE;
+            frame_len = 0;
+            return;
+        }
+        droppedFrames++;
+    }
+    kiss_dropFrame();
 }
 
-void kiss_messageCallback(LLPCtx *ctx) {
-    #if (SERIAL_FRAMING == SERIAL_FRAMING_DIRECT)
-        for (unsigned i = 0; i < ctx->frame_len; i++) {
-            uint8_t b = ctx->buf[i];
-            fputc(b, &serial->uart0);
+static void kiss_dequeue(void) {
+    pool_release(queue[queueHead].block);
+    queueHead = (queueHead + 1) % CONFIG_KISS_QUEUE_LEN;
+    queueCount--;
+}
+
+// Frames to the host are written out by a small
+// state machine, that puts as many bytes in the
+// UART TX buffer as there is room for and then
+// returns. This lets received frames be sent on
+// to the host from a scheduler task, without
+// holding up everything else while the UART
+// catches up.
+static uint8_t outHeader[4];
+static uint8_t outHeaderLen;
+static uint8_t outHeaderPos;
+static const uint8_t *outBuf;
+static size_t outLen;
+static size_t outPos;
+static uint8_t outTrailer[2];
+static uint8_t outTrailerLen;
+static uint8_t outTrailerPos;
+static uint8_t outEscape;               // Second half of an escaped byte, if any
+static bool outBusy;                    // A frame is being output
+static bool outReply;                   // The frame being output is a reply
+
+typedef struct KissReply {
+    uint8_t cmd;
+    uint8_t len;
+    uint8_t data[KISS_REPLY_MAXLEN];
+} KissReply;
+
+static KissReply replies[CONFIG_KISS_REPLY_SLOTS];
+static uint8_t replyHead;
+static uint8_t replyCount;
+
+static void kiss_outputStart(uint8_t cmd, const uint8_t *buf, size_t len) {
+    #if SERIAL_FRAMING == SERIAL_FRAMING_DIRECT
+        // Direct framing has no room for commands,
+        // so only the payload is sent.
+        (void)cmd;
+        outHeaderLen = 0;
+        outTrailerLen = 0;
+    #elif SERIAL_FRAMING == SERIAL_FRAMING_BINARY
+        outHeader[0] = BINARY_SYNC;
+        outHeader[1] = len >> 8;
+        outHeader[2] = len & 0xFF;
+        outHeader[3] = cmd;
+        outHeaderLen = 1 + BINARY_HEADER_SIZE;
+
+        uint16_t crc = CRC_CCIT_INIT_VAL;
+        for (uint8_t i = 1; i < outHeaderLen; i++) {
+            crc = update_crc_ccit(outHeader[i], crc);
+        }
+        for (size_t i = 0; i < len; i++) {
+            crc = update_crc_ccit(buf[i], crc);
         }
+        outTrailer[0] = (crc & 0xFF) ^ 0xFF;
+        outTrailer[1] = (crc >> 8) ^ 0xFF;
+        outTrailerLen = BINARY_CRC_SIZE;
     #else
-        fputc(FEND, &serial->uart0);
-        fputc(0x00, &serial->uart0);
-        for (unsigned i = 0; i < ctx->frame_len; i++) {
-            uint8_t b = ctx->buf[i];
-            if (b == FEND) {
-                fputc(FESC, &serial->uart0);
-                fputc(TFEND, &serial->uart0);
-            } else if (b == FESC) {
-                fputc(FESC, &serial->uart0);
-                fputc(TFESC, &serial->uart0);
+        outHeader[0] = FEND;
+        outHeader[1] = cmd;
+        outHeaderLen = 2;
+        outTrailer[0] = FEND;
+        outTrailerLen = 1;
+    #endif
+
+    outHeaderPos = 0;
+    outBuf = buf;
+    outLen = len;
+    outPos = 0;
+    outTrailerPos = 0;
+    outEscape = 0;
+}
+
+// Writes as much of the current frame as the
+// UART will take. Returns true once all of it
+// has been written.
+static bool kiss_outputPump(void) {
+    while (outHeaderPos < outHeaderLen) {
+        if (!uart0_putchar_nowait(outHeader[outHeaderPos])) return false;
+        outHeaderPos++;
+    }
+
+    while (outPos < outLen) {
+        #if SERIAL_FRAMING == SERIAL_FRAMING_BINARY
+            size_t n = serial_write(serial, &outBuf[outPos], outLen - outPos);
+            if (n == 0) return false;
+            outPos += n;
+        #elif SERIAL_FRAMING == SERIAL_FRAMING_DIRECT
+            if (!uart0_putchar_nowait(outBuf[outPos])) return false;
+            outPos++;
+        #else
+            uint8_t b = outBuf[outPos];
+            if (outEscape) {
+                if (!uart0_putchar_nowait(outEscape)) return false;
+                outEscape = 0;
+                outPos++;
+            } else if (b == FEND || b == FESC) {
+                if (!uart0_putchar_nowait(FESC)) return false;
+                outEscape = (b == FEND) ? TFEND : TFESC;
             } else {
-                fputc(b, &serial->uart0);
+                if (!uart0_putchar_nowait(b)) return false;
+                outPos++;
             }
+        #endif
+    }
+
+    while (outTrailerPos < outTrailerLen) {
+        if (!uart0_putchar_nowait(outTrailer[outTrailerPos])) return false;
+        outTrailerPos++;
+    }
+
+    return true;
+}
+
+// Queues a reply to the host with the given
+// command byte, and returns right away. The output
+// task writes it in whatever framing we are
+// configured for, once any received frame it is
+// in the middle of has been written.
+static void kiss_sendFrame(uint8_t cmd, const uint8_t *buf, size_t len) {
+    if (replyCount == CONFIG_KISS_REPLY_SLOTS || len > KISS_REPLY_MAXLEN) return;
+
+    KissReply *reply = &replies[(replyHead + replyCount) % CONFIG_KISS_REPLY_SLOTS];
+    reply->cmd = cmd;
+    reply->len = len;
+    memcpy(reply->data, buf, len);
+    replyCount++;
+    sched_wake(outputTask);
+}
+
+#if SERIAL_FRAMING != SERIAL_FRAMING_DIRECT
+// Called once a reply has been written. The new
+// baudrate is only set after the acknowledgement
+// has gone out at the old rate. The serial task
+// makes the actual switch when the UART is done
+// sending it.
+static void kiss_replySent(const KissReply *reply) {
+    if (reply->cmd == CMD_SETHARDWARE && reply->data[0] == HW_SETBAUD) {
+        if (fallbackBaud == 0) fallbackBaud = serial->baud;
+        serial_setbaud(serial, serial_baudrate(reply->data[1]));
+        baud_ticks = timer_clock();
+    }
+}
+#endif
+
+// Sends queued replies and frames from the LLP
+// receive queue to the host. Replies go first,
+// but never in the middle of a frame. Once there
+// is nothing left, the task is suspended until a
+// reply is queued, or the LLP callback tells us
+// a new frame has arrived.
+static void kiss_outputTask(void) {
+    if (!outBusy) {
+        if (replyCount > 0) {
+            KissReply *reply = &replies[replyHead];
+            kiss_outputStart(reply->cmd, reply->data, reply->len);
+            outReply = true;
+        } else {
+            const LLPMsg *msg = llp_rxFrame(llpCtx);
+            if (msg == NULL) {
+                sched_suspend();
+                return;
+            }
+            kiss_outputStart(CMD_DATA, msg->data, msg->len);
+            outReply = false;
         }
-        fputc(FEND, &serial->uart0);
-    #endif
+        outBusy = true;
+    }
+
+    if (kiss_outputPump()) {
+        outBusy = false;
+        if (outReply) {
+            #if SERIAL_FRAMING != SERIAL_FRAMING_DIRECT
+                kiss_replySent(&replies[replyHead]);
+            #endif
+            replyHead = (replyHead + 1) % CONFIG_KISS_REPLY_SLOTS;
+            replyCount--;
+        } else {
+            llp_rxRelease(llpCtx);
+        }
+    }
 }
 
-void kiss_csma(LLPCtx *ctx, uint8_t *buf, size_t len) {
-    bool sent = false;
-    while (!sent) {
-        //puts("Waiting in CSMA");
-        if(!channel->hdlc.receiving) {
-            uint8_t tp = rand() & 0xFF;
-            if (tp < p) {
-                //llp_sendRaw(ctx, buf, len);
-                llp_broadcast(ctx, buf, len);
-                sent = true;
-            } else {
-                ticks_t start = timer_clock();
-                long slot_ticks = ms_to_ticks(slotTime);
-                while (timer_clock() - start < slot_ticks) {
-                    cpu_relax();
-                }
+void kiss_messageCallback(LLPCtx *ctx, const LLPMsg *msg) {
+    sched_wake(outputTask);
+}
+
+// This runs as a scheduler task, and never
+// blocks. It waits for the channel to be clear,
+// does p-persistent CSMA, and then encodes the
+// frame at the head of the queue a chunk at a
+// time, as the modem makes room for it. While
+// that happens, the host can keep queueing more
+// frames. When the queue is empty the task is
+// suspended until a new frame is queued, and
+// between CSMA slots it sleeps.
+void kiss_csma(void) {
+    if (txState == KISS_TX_IDLE) {
+        if (queueCount == 0) {
+            sched_suspend();
+            return;
+        }
+
+        if (AFSK_receiving(channel)) {
+            if (channel->status != 0) {
+                // If an overflow or other error
+                // occurs, we'll back off and drop
+                // this packet silently.
+                channel->status = 0;
+                kiss_dequeue();
             }
+            return;
+        }
+
+        uint8_t tp = rand() & 0xFF;
+        if (tp >= p) {
+            sched_sleep(ms_to_ticks(slotTime));
+            return;
+        }
+
+        if (fifo_space(&channel->txFifo) < LLP_SEND_CHUNK_SPACE) return;
+
+        txHeaderLen = llp_broadcastStart(llpCtx, queue[queueHead].len, txHeader);
+        txHeaderSent = 0;
+        txBlock = queue[queueHead].block;
+        txSent = 0;
+        txState = KISS_TX_SENDING;
+    }
+
+    KissFrame *frame = &queue[queueHead];
+    while (fifo_space(&channel->txFifo) >= LLP_SEND_CHUNK_SPACE) {
+        if (txHeaderSent < txHeaderLen) {
+            uint8_t n = txHeaderLen - txHeaderSent;
+            if (n > LLP_SEND_CHUNK) n = LLP_SEND_CHUNK;
+            llp_sendData(llpCtx, &txHeader[txHeaderSent], n);
+            txHeaderSent += n;
+        } else if (txSent < frame->len) {
+            uint8_t offset = txSent % CONFIG_KISS_BLOCK_SIZE;
+            size_t n = frame->len - txSent;
+            if (n > LLP_SEND_CHUNK) n = LLP_SEND_CHUNK;
+            if (n > CONFIG_KISS_BLOCK_SIZE - offset) n = CONFIG_KISS_BLOCK_SIZE - offset;
+            llp_sendData(llpCtx, &pool[txBlock][offset], n);
+            txSent += n;
+            if (txSent % CONFIG_KISS_BLOCK_SIZE == 0) txBlock = poolNext[txBlock];
         } else {
-            while (!sent && channel->hdlc.receiving) {
-                // Continously poll the modem for data
-                // while waiting, so we don't overrun
-                // receive buffers
-                llp_poll(llpCtx);
-
-                if (channel->status != 0) {
-                    // If an overflow or other error
-                    // occurs, we'll back off and drop
-                    // this packet silently.
-                    channel->status = 0;
-                    sent = true;
-                }
+            llp_sendEnd(llpCtx);
+            kiss_dequeue();
+            txState = KISS_TX_IDLE;
+
+            if (FLOWCONTROL) {
+                uint8_t ready = 0x01;
+                kiss_sendFrame(CMD_READY, &ready, 1);
             }
+            return;
         }
     }
+}
+
+#if SERIAL_FRAMING != SERIAL_FRAMING_DIRECT
+static void kiss_hardwareReply(uint8_t subcommand, uint8_t value) {
+    uint8_t reply[2] = { subcommand, value };
+    kiss_sendFrame(CMD_SETHARDWARE, reply, sizeof(reply));
+}
 
-    if (FLOWCONTROL) {
-        while (!ctx->ready_for_data) { /* Wait */ }
-        fputc(FEND, &serial->uart0);
-        fputc(CMD_READY, &serial->uart0);
-        fputc(0x01, &serial->uart0);
-        fputc(FEND, &serial->uart0);
+static void kiss_queueReply(void) {
+    uint8_t reply[5] = { HW_GETQUEUE, queueCount, CONFIG_KISS_QUEUE_LEN, poolFreeCount, droppedFrames };
+    kiss_sendFrame(CMD_SETHARDWARE, reply, sizeof(reply));
+}
+
+// Reports the lock time of the last lock, in
+// bits, and the number of bit slips seen, both
+// as 16 bit big-endian values
+static void kiss_pllReply(void) {
+    uint16_t lockTime = channel->pllLockTime;
+    uint16_t slips = channel->pllSlips;
+    uint8_t reply[5] = { HW_GETPLL, lockTime >> 8, lockTime & 0xFF, slips >> 8, slips & 0xFF };
+    kiss_sendFrame(CMD_SETHARDWARE, reply, sizeof(reply));
+}
+
+// Reports the peak input level and the DC offset
+// of the input, both in ADC counts, and the AGC
+// gain with AGC_GAIN_FRAC bits of fraction. All
+// are 16 bit big-endian values, and the offset
+// is signed, relative to the middle of the ADC
+// range.
+static void kiss_levelReply(void) {
+    uint16_t level = channel->inputLevel;
+    uint16_t offset = channel->adcBias - ADC_BIAS_CENTER;
+    uint16_t gain = channel->adcGain;
+    uint8_t reply[7] = { HW_GETLEVEL, level >> 8, level & 0xFF, offset >> 8, offset & 0xFF, gain >> 8, gain & 0xFF };
+    kiss_sendFrame(CMD_SETHARDWARE, reply, sizeof(reply));
+}
+
+// Reports the modem profile used for sending, by
+// its index and its bitrate as a 16 bit big-endian
+// value, followed by the index of the profile the
+// demodulator is set to. The two differ when the
+// demodulator has followed another station.
+static void kiss_profileReply(void) {
+    uint16_t bitrate = AFSK_profileBitrate(channel->txProfile);
+    uint8_t reply[5] = { HW_SETPROFILE, channel->txProfile, bitrate >> 8, bitrate & 0xFF, channel->profileIndex };
+    kiss_sendFrame(CMD_SETHARDWARE, reply, sizeof(reply));
+}
+
+// Reports the bytes from the host that were lost
+// because the serial RX buffer was full, the ones
+// lost in the USART itself, the ADC samples
+// dropped because the demodulator fell behind,
+// and the frames aborted because the encoder fell
+// behind the DAC, all as 16 bit big-endian values.
+// Most of the counters are updated in ISRs, so
+// they are read atomically.
+static void kiss_statsReply(void) {
+    uint16_t overflows, overruns, adcOverruns;
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+        overflows = serial->rxOverflows;
+        overruns = serial->rxOverruns;
+        adcOverruns = channel->adcOverruns;
+    }
+    uint16_t txUnderruns = channel->txUnderruns;
+    uint8_t reply[9] = { HW_GETSTATS, overflows >> 8, overflows & 0xFF, overruns >> 8, overruns & 0xFF,
+                         adcOverruns >> 8, adcOverruns & 0xFF, txUnderruns >> 8, txUnderruns & 0xFF };
+    kiss_sendFrame(CMD_SETHARDWARE, reply, sizeof(reply));
+}
+
+static void kiss_setHardware(uint8_t *buf, size_t len) {
+    if (len == 0) return;
+    uint8_t subcommand = buf[0];
+
+    if (subcommand == HW_SETBAUD && len >= 2) {
+        if (serial_baudrate(buf[1]) == 0) return;
+
+        // We acknowledge at the old rate, and then
+        // switch, when the output task has written
+        // the reply. If the host doesn't confirm at
+        // the new rate in time, we fall back.
+        kiss_hardwareReply(HW_SETBAUD, buf[1]);
+    } else if (subcommand == HW_CONFIRMBAUD) {
+        fallbackBaud = 0;
+        kiss_hardwareReply(HW_CONFIRMBAUD, 0x01);
+    } else if (subcommand == HW_GETQUEUE) {
+        kiss_queueReply();
+    } else if (subcommand == HW_GETPLL) {
+        kiss_pllReply();
+    } else if (subcommand == HW_GETLEVEL) {
+        kiss_levelReply();
+    } else if (subcommand == HW_SETPROFILE) {
+        // Without an argument, this just asks for
+        // the current profile. If the profile can't
+        // be changed, because the index is unknown
+        // or the modem is transmitting, the reply
+        // shows the profile that is still in use.
+        if (len >= 2) AFSK_setProfile(channel, buf[1]);
+        kiss_profileReply();
+    } else if (subcommand == HW_GETSTATS) {
+        kiss_statsReply();
+    }
+}
+#endif
+
+void kiss_checkBaudTimeout(void) {
+    // The host gets the full confirmation time
+    // at the new rate, counted from when the
+    // switch actually happened
+    if (serial->pendingBaud) baud_ticks = timer_clock();
+
+    if (fallbackBaud != 0 && timer_clock() - baud_ticks > ms_to_ticks(CONFIG_BAUD_CONFIRM_MS)) {
+        serial_setbaud(serial, fallbackBaud);
+        fallbackBaud = 0;
+        IN_FRAME = false;
+        kiss_dropFrame();
+        #if SERIAL_FRAMING == SERIAL_FRAMING_BINARY
+            binaryState = BINARY_STATE_SYNC;
+        #endif
     }
 }
 
 void kiss_checkTimeout(bool force) {
     if (force || (IN_FRAME && timer_clock() - timeout_ticks > ms_to_ticks(TX_MAXWAIT))) {
-        kiss_csma(llpCtx, serialBuffer, frame_len);
+        kiss_endFrame();
         IN_FRAME = false;
-        frame_len = 0;
     }
     
 }
 
+// The timeouts only need millisecond resolution,
+// so there is no need to check them every pass
+static void kiss_timeoutTask(void) {
+    #if SERIAL_FRAMING == SERIAL_FRAMING_DIRECT
+        kiss_checkTimeout(false);
+    #else
+        kiss_checkBaudTimeout();
+    #endif
+    sched_sleep(ms_to_ticks(1));
+}
+
+#if SERIAL_FRAMING != SERIAL_FRAMING_DIRECT
+static void kiss_setParameter(uint8_t cmd, uint8_t sbyte) {
+    if (cmd == CMD_TXDELAY) {
+        custom_preamble = sbyte * 10UL;
+    } else if (cmd == CMD_TXTAIL) {
+        custom_tail = sbyte * 10;
+    } else if (cmd == CMD_SLOTTIME) {
+        slotTime = sbyte * 10;
+    } else if (cmd == CMD_P) {
+        p = sbyte;
+    } else if (cmd == CMD_READY) {
+        if (sbyte == 0x00) {
+            FLOWCONTROL = false;
+        } else {
+            FLOWCONTROL = true;
+        }
+    }
+}
+#endif
+
+#if SERIAL_FRAMING == SERIAL_FRAMING_BINARY
+static void kiss_binaryFrame(uint8_t cmd, uint8_t *buf, size_t len) {
+    if (cmd == CMD_DATA) {
+        kiss_endFrame();
+    } else if (cmd == CMD_SETHARDWARE) {
+        kiss_setHardware(buf, len);
+    } else if (len > 0) {
+        kiss_setParameter(cmd, buf[0]);
+    }
+}
+#endif
+
 void kiss_serialCallback(uint8_t sbyte) {
     #if SERIAL_FRAMING == SERIAL_FRAMING_DIRECT
         timeout_ticks = timer_clock();
         IN_FRAME = true;
-        serialBuffer[frame_len++] = sbyte;
+        kiss_append(sbyte);
         if (frame_len >= LLP_MAX_DATA_SIZE) kiss_checkTimeout(true);
+    #elif SERIAL_FRAMING == SERIAL_FRAMING_BINARY
+        timeout_ticks = timer_clock();
+        if (binaryState == BINARY_STATE_SYNC) {
+            if (sbyte == BINARY_SYNC) {
+                binaryState = BINARY_STATE_HEADER;
+                binaryCount = 0;
+                binaryCrc = CRC_CCIT_INIT_VAL;
+            }
+        } else if (binaryState == BINARY_STATE_HEADER) {
+            binaryHeader[binaryCount++] = sbyte;
+            binaryCrc = update_crc_ccit(sbyte, binaryCrc);
+            if (binaryCount == BINARY_HEADER_SIZE) {
+                binaryLength = ((size_t)binaryHeader[0] << 8) | binaryHeader[1];
+                // MicroModem supports only one HDLC port, so we
+                // strip off the port nibble of the command byte
+                command = binaryHeader[2] & 0x0F;
+                kiss_dropFrame();
+                cmd_len = 0;
+                binaryReceived = 0;
+                binaryCount = 0;
+                if (binaryLength > LLP_MAX_DATA_SIZE || (command != CMD_DATA && binaryLength > KISS_CMD_BUFLEN)) {
+                    binaryState = BINARY_STATE_SYNC;
+                } else if (binaryLength == 0) {
+                    binaryState = BINARY_STATE_CRC;
+                } else {
+                    binaryState = BINARY_STATE_PAYLOAD;
+                }
+            }
+        } else if (binaryState == BINARY_STATE_PAYLOAD) {
+            if (command == CMD_DATA) {
+                kiss_append(sbyte);
+            } else {
+                cmdBuffer[cmd_len++] = sbyte;
+            }
+            binaryCrc = update_crc_ccit(sbyte, binaryCrc);
+            if (++binaryReceived == binaryLength) binaryState = BINARY_STATE_CRC;
+        } else {
+            binaryCrc = update_crc_ccit(sbyte, binaryCrc);
+            if (++binaryCount == BINARY_CRC_SIZE) {
+                binaryState = BINARY_STATE_SYNC;
+                if (binaryCrc == BINARY_CRC_CORRECT) {
+                    kiss_binaryFrame(command, cmdBuffer, cmd_len);
+                }
+                kiss_dropFrame();
+            }
+        }
     #else
         if (IN_FRAME && sbyte == FEND && command == CMD_DATA) {
             IN_FRAME = false;
-            kiss_csma(llpCtx, serialBuffer, frame_len);
+            kiss_endFrame();
+        } else if (IN_FRAME && sbyte == FEND && command == CMD_SETHARDWARE) {
+            IN_FRAME = false;
+            kiss_setHardware(cmdBuffer, cmd_len);
         } else if (sbyte == FEND) {
             IN_FRAME = true;
             command = CMD_UNKNOWN;
-            frame_len = 0;
-        } else if (IN_FRAME && frame_len < LLP_MAX_DATA_SIZE) {
+            kiss_dropFrame();
+            cmd_len = 0;
+        } else if (IN_FRAME) {
             // Have a look at the command byte first
-            if (frame_len == 0 && command == CMD_UNKNOWN) {
+            if (command == CMD_UNKNOWN) {
                 // MicroModem supports only one HDLC port, so we
                 // strip off the port nibble of the command byte
                 sbyte = sbyte & 0x0F;
                 command = sbyte;
-            } else if (command == CMD_DATA) {
+            } else if (command == CMD_DATA || command == CMD_SETHARDWARE) {
                 if (sbyte == FESC) {
                     ESCAPE = true;
                 } else {
@@ -136,24 +706,60 @@ void kiss_serialCallback(uint8_t sbyte) {
                         if (sbyte == TFESC) sbyte = FESC;
                         ESCAPE = false;
                     }
-                    serialBuffer[frame_len++] = sbyte;
-                }
-            } else if (command == CMD_TXDELAY) {
-                custom_preamble = sbyte * 10UL;
-            } else if (command == CMD_TXTAIL) {
-                custom_tail = sbyte * 10;
-            } else if (command == CMD_SLOTTIME) {
-                slotTime = sbyte * 10;
-            } else if (command == CMD_P) {
-                p = sbyte;
-            } else if (command == CMD_READY) {
-                if (sbyte == 0x00) {
-                    FLOWCONTROL = false;
-                } else {
-                    FLOWCONTROL = true;
+                    if (command == CMD_DATA) {
+                        kiss_append(sbyte);
+                    } else if (cmd_len < KISS_CMD_BUFLEN) {
+                        cmdBuffer[cmd_len++] = sbyte;
+                    }
                 }
+            } else {
+                kiss_setParameter(command, sbyte);
             }
             
         }
     #endif
-}
\ No newline at end of file
+}
+
+// Handles whatever the host has sent since the
+// last pass, up to CONFIG_KISS_RX_BUDGET bytes
+// or chunks of binary payload, so that a fast
+// host is kept up with without starving the
+// other tasks.
+void kiss_serialPoll(void) {
+    serial_poll(serial);
+
+    #if SERIAL_FRAMING == SERIAL_FRAMING_BINARY
+        if (binaryState != BINARY_STATE_SYNC && timer_clock() - timeout_ticks > ms_to_ticks(CONFIG_BINARY_TIMEOUT_MS)) {
+            binaryState = BINARY_STATE_SYNC;
+            kiss_dropFrame();
+        }
+    #endif
+
+    for (uint8_t budget = CONFIG_KISS_RX_BUDGET; budget > 0; budget--) {
+        #if SERIAL_FRAMING == SERIAL_FRAMING_BINARY
+            // Since the payload is never escaped, we can
+            // copy as much of it as has arrived straight
+            // into the block pool in one go
+            if (binaryState == BINARY_STATE_PAYLOAD && command == CMD_DATA) {
+                size_t room;
+                uint8_t *dst = kiss_reserve(&room);
+                if (dst) {
+                    if (room > binaryLength - binaryReceived) room = binaryLength - binaryReceived;
+                    size_t n = serial_read(serial, dst, room);
+                    if (n == 0) return;
+                    for (size_t i = 0; i < n; i++) {
+                        binaryCrc = update_crc_ccit(dst[i], binaryCrc);
+                    }
+                    frame_len += n;
+                    binaryReceived += n;
+                    timeout_ticks = timer_clock();
+                    if (binaryReceived == binaryLength) binaryState = BINARY_STATE_CRC;
+                    continue;
+                }
+            }
+        #endif
+
+        if (!serial_available(0)) return;
+        kiss_serialCallback(uart0_getchar_nowait());
+    }
+}
@@ -4,14 +4,75 @@
 #include "../hardware/AFSK.h"
 #include "../hardware/Serial.h"
 #include "../util/time.h"
+#include "../util/scheduler.h"
 #include "LLP.h"
 #include "config.h"
 
+#include "../util/CRC-CCIT.h"
+
 #define FEND 0xC0
 #define FESC 0xDB
 #define TFEND 0xDC
 #define TFESC 0xDD
 
+// Binary framing uses the same command codes as
+// KISS, but instead of escaping, every frame has
+// a header with the payload length, and a CRC:
+//
+// SYNC | LEN_H | LEN_L | CMD | PAYLOAD | CRC_L | CRC_H
+//
+// The CRC is CRC-CCIT over everything from LEN_H
+// to the end of the payload, sent complemented,
+// just like on the radio side. If a frame stalls
+// for longer than CONFIG_BINARY_TIMEOUT_MS, the
+// parser gives up and looks for the next SYNC.
+#define BINARY_SYNC 0xA5
+#define BINARY_HEADER_SIZE 3
+#define BINARY_CRC_SIZE 2
+#define BINARY_CRC_CORRECT 0xF0B8
+#define CONFIG_BINARY_TIMEOUT_MS 100UL
+
+// Frames waiting for the channel are kept in a
+// pool of fixed size blocks. The pool must be
+// able to hold at least one frame of maximum
+// length, and there can be at most 254 blocks.
+#define CONFIG_KISS_BLOCK_SIZE 64
+#if TARGET_CPU == m328p
+    #define CONFIG_KISS_POOL_BLOCKS 9
+    #define CONFIG_KISS_QUEUE_LEN 4
+#else
+    #define CONFIG_KISS_POOL_BLOCKS 40
+    #define CONFIG_KISS_QUEUE_LEN 8
+#endif
+
+#if CONFIG_KISS_POOL_BLOCKS * CONFIG_KISS_BLOCK_SIZE < LLP_MAX_DATA_SIZE || CONFIG_KISS_POOL_BLOCKS > 254
+    #error Unsupported KISS pool size!
+#endif
+
+// Frames are only encoded when the modem has room
+// for a whole interleaved block
+#if LLP_SEND_CHUNK_SPACE > CONFIG_AFSK_TX_BUFLEN
+    #error The AFSK TX buffer is too small for the LLP interleave size!
+#endif
+
+// The most bytes the serial task handles from
+// the RX buffer each time it runs. At the high
+// baudrates, a pass that only takes one byte
+// can't keep up with the host.
+#define CONFIG_KISS_RX_BUDGET 32
+
+// Room for the arguments of commands other
+// than data frames
+#define KISS_CMD_BUFLEN 8
+
+// Replies to the host, like SETHARDWARE answers
+// and the flow control READY frame, are queued
+// in a few small slots, and written out by the
+// output task between received frames. A reply
+// that finds all slots taken is dropped.
+#define CONFIG_KISS_REPLY_SLOTS 4
+#define KISS_REPLY_MAXLEN 9
+
 #define CMD_UNKNOWN 0xFE
 #define CMD_DATA 0x00
 #define CMD_TXDELAY 0x01
@@ -23,10 +84,30 @@
 #define CMD_READY 0x0F
 #define CMD_RETURN 0xFF
 
-void kiss_init(LLPCtx *ctx, Afsk *afsk, Serial *ser);
-void kiss_csma(LLPCtx *ctx, uint8_t *buf, size_t len);
-void kiss_messageCallback(LLPCtx *ctx);
+// Subcommands for CMD_SETHARDWARE. The first
+// byte of a SETHARDWARE frame selects one of
+// these, and the rest are its arguments.
+#define HW_SETBAUD 0x01
+#define HW_CONFIRMBAUD 0x02
+#define HW_GETQUEUE 0x03
+#define HW_GETPLL 0x04
+#define HW_GETLEVEL 0x05
+#define HW_SETPROFILE 0x06
+#define HW_GETSTATS 0x07
+
+// When the baudrate is changed, the host must
+// send HW_CONFIRMBAUD at the new rate within
+// this time, or the modem goes back to the old
+// rate. That way a host that can't follow will
+// never lose contact with the modem.
+#define CONFIG_BAUD_CONFIRM_MS 2000UL
+
+bool kiss_init(LLPCtx *ctx, Afsk *afsk, Serial *ser);
+void kiss_csma(void);
+void kiss_messageCallback(LLPCtx *ctx, const LLPMsg *msg);
 void kiss_serialCallback(uint8_t sbyte);
+void kiss_serialPoll(void);
 void kiss_checkTimeout(bool force);
+void kiss_checkBaudTimeout(void);
 
 #endif
\ No newline at end of file
@@ -0,0 +1,77 @@
+#include <string.h>
+#include "LLP-interleave.h"
+
+// Transposes an 8x8 bit matrix in place. Row r is
+// byte r, and column c is bit 7-c of every byte.
+// Instead of moving one bit at a time, the two
+// off-diagonal 4x4 blocks are swapped, then the
+// 2x2 blocks inside each 4x4 block, and finally
+// single bits. Each swap works on a pair of bytes
+// with shifts and masks, so it is only 12 byte
+// pair swaps in all.
+static void llp_transpose8(uint8_t *m) {
+    uint8_t t;
+    for (uint8_t i = 0; i < 4; i++) {
+        t = ((m[i+4] >> 4) ^ m[i]) & 0x0F;
+        m[i]   ^= t;
+        m[i+4] ^= t << 4;
+    }
+    for (uint8_t i = 0; i < 8; i += 4) {
+        for (uint8_t j = i; j < i+2; j++) {
+            t = ((m[j+2] >> 2) ^ m[j]) & 0x33;
+            m[j]   ^= t;
+            m[j+2] ^= t << 2;
+        }
+    }
+    for (uint8_t i = 0; i < 8; i += 2) {
+        t = ((m[i+1] >> 1) ^ m[i]) & 0x55;
+        m[i]   ^= t;
+        m[i+1] ^= t << 1;
+    }
+}
+
+// Both directions handle the columns 8 at a
+// time. When k is a multiple of 8, every row of
+// a group is a whole byte, and nothing needs to
+// be shifted. Otherwise the rows are picked out
+// of, or put back into, the bit stream with
+// shifts across two bytes.
+void llp_interleaveBits(const uint8_t *in, uint8_t *out, uint8_t k) {
+    uint8_t m[8];
+    for (uint8_t col = 0; col < k; col += 8) {
+        uint16_t offset = col;
+        for (uint8_t row = 0; row < 8; row++) {
+            uint8_t i = offset >> 3;
+            uint8_t shift = offset & 7;
+            m[row] = in[i] << shift;
+            if (shift && i+1 < k) m[row] |= in[i+1] >> (8 - shift);
+            offset += k;
+        }
+
+        // Bits past column k end up in the bytes
+        // after the last column, which are not used
+        llp_transpose8(m);
+        uint8_t n = k - col < 8 ? k - col : 8;
+        memcpy(&out[col], m, n);
+    }
+}
+
+void llp_deinterleaveBits(const uint8_t *in, uint8_t *out, uint8_t k) {
+    uint8_t m[8];
+    memset(out, 0, k);
+    for (uint8_t col = 0; col < k; col += 8) {
+        uint8_t n = k - col < 8 ? k - col : 8;
+        memcpy(m, &in[col], n);
+        memset(&m[n], 0, 8 - n);
+        llp_transpose8(m);
+
+        uint16_t offset = col;
+        for (uint8_t row = 0; row < 8; row++) {
+            uint8_t i = offset >> 3;
+            uint8_t shift = offset & 7;
+            out[i] |= m[row] >> shift;
+            if (shift && i+1 < k) out[i+1] |= m[row] << (8 - shift);
+            offset += k;
+        }
+    }
+}
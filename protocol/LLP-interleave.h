@@ -0,0 +1,21 @@
+// Bit interleaving for LLP blocks. This has no
+// dependencies on the rest of the firmware, so
+// the host test in tools/interleave_test.c can
+// build it as it is.
+
+#ifndef PROTOCOL_LLP_INTERLEAVE_H
+#define PROTOCOL_LLP_INTERLEAVE_H
+
+#include <stdint.h>
+
+// Reads the k bytes in "in" as 8 rows of k bits,
+// and writes the k columns to "out". k can be at
+// most 32.
+void llp_interleaveBits(const uint8_t *in, uint8_t *out, uint8_t k);
+
+// The reverse of llp_interleaveBits. Reads the k
+// bytes in "in" as columns, and writes the 8 rows
+// of k bits to "out".
+void llp_deinterleaveBits(const uint8_t *in, uint8_t *out, uint8_t k);
+
+#endif
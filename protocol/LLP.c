@@ -1,6 +1,7 @@
 #include <string.h>
 #include <ctype.h>
 #include "LLP.h"
+#include "LLP-interleave.h"
 #include "protocol/HDLC.h"
 #include "util/CRC-CCIT.h"
 #include "../hardware/AFSK.h"
@@ -9,11 +10,6 @@
 #define PASSALL false
 #define STRIP_HEADERS true
 
-// The GET_BIT macro is used in the interleaver
-// and deinterleaver to access single bits of a
-// byte.
-inline bool GET_BIT(uint8_t byte, int n) { return (byte & (1 << (8-n))) == (1 << (8-n)); }
-
 // We need an indicator to tell us whether we
 // should send a parity byte. This happens
 // whenever two normal bytes of data has been
@@ -25,255 +21,334 @@ static uint8_t lastByte = 0x00;
 
 LLPAddress broadcast_address;
 
-void llp_decode(LLPCtx *ctx) {
+// Points rx->buf at a free slot, if there is
+// one. Returns false if every slot is either
+// holding a frame that has not been released, or
+// being received into by another slicer.
+static bool llp_rxSlot(LLPCtx *ctx, LLPRx *rx) {
+    if (rx->buf == NULL && ctx->slotsFree) {
+        uint8_t slot = 0;
+        while (!(ctx->slotsFree & (1 << slot))) slot++;
+        ctx->slotsFree &= ~(1 << slot);
+        rx->buf = ctx->slots[slot];
+    }
+    return rx->buf != NULL;
+}
+
+// Returns the oldest received frame, without
+// removing it from the queue, or NULL if there
+// are none. The frame stays valid until
+// llp_rxRelease is called.
+const LLPMsg *llp_rxFrame(LLPCtx *ctx) {
+    if (ctx->slotCount == 0) return NULL;
+    return &ctx->msgs[ctx->slotHead];
+}
+
+void llp_rxRelease(LLPCtx *ctx) {
+    if (ctx->slotCount > 0) {
+        ctx->slotsFree |= 1 << ctx->msgSlot[ctx->slotHead];
+        ctx->slotHead = (ctx->slotHead + 1) % CONFIG_LLP_RX_SLOTS;
+        ctx->slotCount--;
+    }
+}
+
+#if CONFIG_AFSK_SLICERS > 1
+// With several slicers, the same frame will
+// usually be decoded more than once, a few bits
+// apart. A frame with the same length and FCS as
+// the last one, that ends within this many ms of
+// it, is the same frame, and is dropped. This
+// must be shorter than it takes to send the
+// smallest frame, or a frame sent twice in a row
+// would be dropped too.
+#define LLP_DUPLICATE_WINDOW 40
+
+static bool llp_duplicate(LLPCtx *ctx, LLPRx *rx) {
+    uint16_t fcs = (rx->buf[rx->frame_len-2] << 8) | rx->buf[rx->frame_len-1];
+    ticks_t now = timer_clock();
+    bool duplicate = rx->frame_len == ctx->lastLength && fcs == ctx->lastFcs &&
+                     now - ctx->lastTime < ms_to_ticks(LLP_DUPLICATE_WINDOW);
+
+    ctx->lastLength = rx->frame_len;
+    ctx->lastFcs = fcs;
+    ctx->lastTime = now;
+    return duplicate;
+}
+#endif
+
+// Parses the header of the frame we have just
+// received, and hands the slot it is in over to
+// the queue. The payload is not copied anywhere;
+// the message just points at where it is in the
+// slot. The hook is then told there is a frame
+// waiting, and the slicer will receive the next
+// frame into another slot.
+static void llp_decode(LLPCtx *ctx, LLPRx *rx) {
     if (ctx->hook) {
-        size_t length = ctx->frame_len;
-        uint8_t *buffer = (uint8_t*)&ctx->buf;
-        size_t padding = buffer[LLP_HEADER_SIZE-1];
-        size_t address_size = 2*sizeof(LLPAddress);
+        uint8_t *buffer = rx->buf;
+        uint8_t padding = buffer[LLP_HEADER_SIZE-1];
+        if (LLP_HEADER_SIZE + padding + LLP_CHECKSUM_SIZE > rx->frame_len) return;
+
+        #if CONFIG_AFSK_SLICERS > 1
+            if (llp_duplicate(ctx, rx)) return;
+        #endif
+
+        uint8_t index = (ctx->slotHead + ctx->slotCount) % CONFIG_LLP_RX_SLOTS;
+        LLPMsg *msg = &ctx->msgs[index];
+        ctx->msgSlot[index] = (buffer - ctx->slots[0]) / LLP_RX_BUFLEN;
+        msg->header.src.network = (buffer[0] << 8) | buffer[1];
+        msg->header.src.host    = (buffer[2] << 8) | buffer[3];
+        msg->header.dst.network = (buffer[4] << 8) | buffer[5];
+        msg->header.dst.host    = (buffer[6] << 8) | buffer[7];
+        msg->header.flags       = buffer[8];
+        msg->header.padding     = padding;
+
         #if STRIP_HEADERS
-            uint8_t strip_headers = 1;
+            msg->data = &buffer[LLP_HEADER_SIZE + padding];
+            msg->len  = rx->frame_len - LLP_HEADER_SIZE - padding - LLP_CHECKSUM_SIZE;
         #else
-            uint8_t strip_headers = 0;
+            // Move the header up against the payload,
+            // so the padding is not passed on. This
+            // is only ever LLP_HEADER_SIZE bytes.
+            memmove(&buffer[padding], buffer, LLP_HEADER_SIZE);
+            msg->data = &buffer[padding];
+            msg->len  = rx->frame_len - padding - LLP_CHECKSUM_SIZE;
         #endif
-        size_t subtraction = (address_size + (LLP_HEADER_SIZE - address_size))*strip_headers + padding;
-        ctx->frame_len = length - subtraction - LLP_CHECKSUM_SIZE;
-
-        for (int i = 0; i < ctx->frame_len; i++) {
-            #if STRIP_HEADERS
-                buffer[i] = buffer[i+subtraction];
-            #else
-                if ( i >= LLP_HEADER_SIZE ) {
-                    buffer[i] = buffer[i+padding];
-                } else {
-                    buffer[i] = buffer[i];
-                }
-            #endif
-        }
 
-        ctx->hook(ctx);
+        ctx->slotCount++;
+        rx->buf = NULL;
+
+        ctx->hook(ctx, msg);
     }
 }
 
-void llp_poll(LLPCtx *ctx) {
-    int c;
-    
+// Handles one byte received by one of the
+// modem slicers
+static void llp_parse(LLPCtx *ctx, LLPRx *rx, uint8_t c) {
+    // The byte after LLP_SOFT is a mask of the weak
+    // bits in the next data byte. It is taken as it
+    // is, whatever its value.
+    if (rx->softMask) {
+        rx->weakNext = c;
+        rx->softMask = false;
+        return;
+    }
+
+    if (!rx->escape && c == LLP_SOFT) {
+        rx->softMask = true;
+        return;
+    }
+
     #if DISABLE_INTERLEAVE
-        while ((c = fgetc(ctx->ch)) != EOF) {
-            if (!ctx->escape && c == HDLC_FLAG) {
-                if (ctx->frame_len >= LLP_MIN_FRAME_LENGTH) {
-                    if (PASSALL || ctx->crc_in == LLP_CRC_CORRECT) {
-                        #if OPEN_SQUELCH == true
-                            LED_RX_ON();
-                        #endif
-                        llp_decode(ctx);
-                    }
+        if (!rx->escape && c == HDLC_FLAG) {
+            // After an abort, the frame has no closing
+            // flag, and is dropped
+            if (rx->sync && rx->frame_len >= LLP_MIN_FRAME_LENGTH) {
+                if (PASSALL || rx->crc_in == LLP_CRC_CORRECT) {
+                    #if OPEN_SQUELCH == true
+                        LED_RX_ON();
+                    #endif
+                    llp_decode(ctx, rx);
                 }
-                ctx->sync = true;
-                ctx->crc_in = CRC_CCIT_INIT_VAL;
-                ctx->frame_len = 0;
-                continue;
             }
+            rx->sync = llp_rxSlot(ctx, rx);
+            rx->crc_in = CRC_CCIT_INIT_VAL;
+            rx->frame_len = 0;
+            return;
+        }
 
-            if (!ctx->escape && c == HDLC_RESET) {
-                ctx->sync = false;
-                continue;
-            }
+        if (!rx->escape && c == HDLC_RESET) {
+            rx->sync = false;
+            return;
+        }
 
-            if (!ctx->escape && c == LLP_ESC) {
-                ctx->escape = true;
-                continue;
-            }
+        if (!rx->escape && c == LLP_ESC) {
+            rx->escape = true;
+            return;
+        }
 
-            if (ctx->sync) {
-                if (ctx->frame_len < LLP_MAX_FRAME_LENGTH) {
-                    ctx->buf[ctx->frame_len++] = c;
-                    ctx->crc_in = update_crc_ccit(c, ctx->crc_in);
-                } else {
-                    ctx->sync = false;
-                }
+        if (rx->sync) {
+            if (rx->frame_len < LLP_RX_BUFLEN) {
+                rx->buf[rx->frame_len++] = c;
+                rx->crc_in = update_crc_ccit(c, rx->crc_in);
+            } else {
+                rx->sync = false;
             }
-            ctx->escape = false;
         }
+        rx->escape = false;
     #else
-        while ((c = fgetc(ctx->ch)) != EOF) {
-            
-            /////////////////////////////////////////////
-            // Start of forward error correction block //
-            /////////////////////////////////////////////
-            if ((ctx->sync && (c != LLP_ESC )) || (ctx->sync && (ctx->escape && (c == LLP_ESC || c == HDLC_FLAG || c == HDLC_RESET)))) {
-                // We have a byte, increment our read counter
-                ctx->readLength++;
-
-                // Check if we have read 12 bytes. If we
-                // have, we should now have a block of two
-                // data bytes and a parity byte. This block
-                if (ctx->readLength % LLP_INTERLEAVE_SIZE == 0) {
-                    // If the last character in the block
-                    // looks like a control character, we
-                    // need to set the escape indicator to
-                    // false, since the next byte will be
-                    // read immediately after the FEC
-                    // routine, and thus, the normal reading
-                    // code will not reset the indicator.
-                    if (c == LLP_ESC || c == HDLC_FLAG || c == HDLC_RESET) ctx->escape = false;
-                    
-                    // The block is interleaved, so we will
-                    // first put the received bytes in the
-                    // deinterleaving buffer
-                    for (int i = 1; i < LLP_INTERLEAVE_SIZE; i++) {
-                        ctx->interleaveIn[i-1] = ctx->buf[ctx->frame_len-(LLP_INTERLEAVE_SIZE-i)];
-                    }
-                    ctx->interleaveIn[LLP_INTERLEAVE_SIZE-1] = c;
-
-                    // We then deinterleave the block
-                    llpDeinterleave(ctx);
-
-                    // Adjust the packet length, since we will get
-                    // parity bytes in the data buffer with block
-                    // sizes larger than 3
-                    ctx->frame_len -= LLP_INTERLEAVE_SIZE/3 - 1;
-
-                    // For each 3-byte block in the deinterleaved
-                    // bytes, we apply forward error correction
-                    for (int i = 0; i < LLP_INTERLEAVE_SIZE; i+=3) {
-                        // We now calculate a parity byte on the
-                        // received data.
-
-                        // Deinterleaved data bytes
-                        uint8_t a = ctx->interleaveIn[i];
-                        uint8_t b = ctx->interleaveIn[i+1];
-
-                        // Deinterleaved parity byte
-                        uint8_t p = ctx->interleaveIn[i+2];
-
-                        ctx->calculatedParity = llpParityBlock(a, b);
-
-                        // By XORing the calculated parity byte
-                        // with the received parity byte, we get
-                        // what is called the "syndrome". This
-                        // number will tell us if we had any
-                        // errors during transmission, and if so
-                        // where they are. Using Hamming code, we
-                        // can only detect single bit errors in a
-                        // byte though, which is why we interleave
-                        // the data, since most errors will usually
-                        // occur in bursts of more than one bit.
-                        // With 2 data byte interleaving we can
-                        // correct 2 consecutive bit errors.
-                        uint8_t syndrome = ctx->calculatedParity ^ p;
-                        if (syndrome == 0x00) {
-                            // If the syndrome equals 0, we either
-                            // don't have any errors, or the error
-                            // is unrecoverable, so we don't do
-                            // anything
-                        } else {
-                            // If the syndrome is not equal to 0,
-                            // there is a problem, and we will try
-                            // to correct it. We first need to split
-                            // the syndrome byte up into the two
-                            // actual syndrome numbers, one for
-                            // each data byte.
-                            uint8_t syndromes[2];
-                            syndromes[0] = syndrome & 0x0f;
-                            syndromes[1] = (syndrome & 0xf0) >> 4;
-
-                            // Then we look at each syndrome number
-                            // to determine what bit in the data
-                            // bytes to correct.
-                            for (int i = 0; i < 2; i++) {
-                                uint8_t s = syndromes[i];
-                                uint8_t correction = 0x00;
-                                if (s == 1 || s == 2 || s == 4 || s == 8) {
-                                    // This signifies an error in the
-                                    // parity block, so we actually
-                                    // don't need any correction
-                                    continue;
-                                }
-
-                                // The following determines what
-                                // bit to correct according to
-                                // the syndrome value.
-                                if (s == 3)  correction = 0x01;
-                                if (s == 5)  correction = 0x02;
-                                if (s == 6)  correction = 0x04;
-                                if (s == 7)  correction = 0x08;
-                                if (s == 9)  correction = 0x10;
-                                if (s == 10) correction = 0x20;
-                                if (s == 11) correction = 0x40;
-                                if (s == 12) correction = 0x80;
-
-                                // And finally we apply the correction
-                                if (i == 1) a ^= correction;
-                                if (i == 0) b ^= correction;
-
-                                // This is just for testing purposes.
-                                // Nice to know when corrections were
-                                // actually made.
-                                if (s != 0) ctx->correctionsMade += 1;
-                            }
-                        }
-
-                        // We now update the checksum of the packet
-                        // with the deinterleaved and possibly
-                        // corrected bytes.
-                        
-                        ctx->crc_in = update_crc_ccit(a, ctx->crc_in);
-                        ctx->crc_in = update_crc_ccit(b, ctx->crc_in);
-
-                        ctx->buf[ctx->frame_len-(LLP_DATA_BLOCK_SIZE)+((i/3)*2)] = a;
-                        ctx->buf[ctx->frame_len-(LLP_DATA_BLOCK_SIZE-1)+((i/3)*2)] = b;
+        /////////////////////////////////////////////
+        // Start of forward error correction block //
+        /////////////////////////////////////////////
+        if ((rx->sync && (c != LLP_ESC )) || (rx->sync && (rx->escape && (c == LLP_ESC || c == HDLC_FLAG || c == HDLC_RESET)))) {
+            // We have a byte, increment our read counter,
+            // and keep its weak bits for the decoder
+            rx->readLength++;
+            rx->weakIn[(rx->readLength - 1) % LLP_INTERLEAVE_SIZE] = rx->weakNext;
+            rx->weakNext = 0;
+
+            // Check if we have read 12 bytes. If we
+            // have, we should now have a block of two
+            // data bytes and a parity byte. This block
+            if (rx->readLength % LLP_INTERLEAVE_SIZE == 0) {
+                // If the last character in the block
+                // looks like a control character, we
+                // need to set the escape indicator to
+                // false, since the next byte will be
+                // read immediately after the FEC
+                // routine, and thus, the normal reading
+                // code will not reset the indicator.
+                if (c == LLP_ESC || c == HDLC_FLAG || c == HDLC_RESET || c == LLP_SOFT) rx->escape = false;
+                
+                // The block is interleaved, so we will
+                // first put the received bytes in the
+                // deinterleaving buffer
+                for (int i = 1; i < LLP_INTERLEAVE_SIZE; i++) {
+                    rx->interleaveIn[i-1] = rx->buf[rx->frame_len-(LLP_INTERLEAVE_SIZE-i)];
+                }
+                rx->interleaveIn[LLP_INTERLEAVE_SIZE-1] = c;
+
+                // We then deinterleave the block, and the
+                // weak bits along with it
+                llpDeinterleave(rx->interleaveIn);
+                llpDeinterleave(rx->weakIn);
+
+                // Adjust the packet length, since we will get
+                // parity bytes in the data buffer with block
+                // sizes larger than 3
+                rx->frame_len -= LLP_INTERLEAVE_SIZE/3 - 1;
+
+                // For each 3-byte block in the deinterleaved
+                // bytes, we apply forward error correction
+                for (int i = 0; i < LLP_INTERLEAVE_SIZE; i+=3) {
+                    // Deinterleaved data bytes
+                    uint8_t a = rx->interleaveIn[i];
+                    uint8_t b = rx->interleaveIn[i+1];
+
+                    // Deinterleaved parity byte
+                    uint8_t p = rx->interleaveIn[i+2];
+
+                    // Check the parity and correct what
+                    // we can. Using Hamming code, we can
+                    // only correct single bit errors in a
+                    // byte though, which is why we interleave
+                    // the data, since most errors will usually
+                    // occur in bursts of more than one bit.
+                    // If the demodulator marked any of the
+                    // bits as weak, the soft decoder can
+                    // also fix two errors in weak bits.
+                    uint8_t pw = rx->weakIn[i+2];
+                    if (rx->weakIn[i] | rx->weakIn[i+1] | pw) {
+                        rx->correctionsMade += llp_fec_decode_soft(&a, p & 0x0F, rx->weakIn[i], pw & 0x0F);
+                        rx->correctionsMade += llp_fec_decode_soft(&b, p >> 4, rx->weakIn[i+1], pw >> 4);
+                    } else {
+                        rx->correctionsMade += llp_fec_decode_block(&a, &b, p);
                     }
 
-                    continue;
+                    // We now update the checksum of the packet
+                    // with the deinterleaved and possibly
+                    // corrected bytes.
+                    
+                    rx->crc_in = update_crc_ccit(a, rx->crc_in);
+                    rx->crc_in = update_crc_ccit(b, rx->crc_in);
+
+                    rx->buf[rx->frame_len-(LLP_DATA_BLOCK_SIZE)+((i/3)*2)] = a;
+                    rx->buf[rx->frame_len-(LLP_DATA_BLOCK_SIZE-1)+((i/3)*2)] = b;
                 }
+
+                return;
             }
-            /////////////////////////////////////////////
-            // End of forward error correction block   //
-            /////////////////////////////////////////////
-
-            if (!ctx->escape && c == HDLC_FLAG) {
-                if (ctx->frame_len >= LLP_MIN_FRAME_LENGTH) {
-                    if (PASSALL || ctx->crc_in == LLP_CRC_CORRECT) {
-                        #if OPEN_SQUELCH == true
-                            LED_RX_ON();
-                        #endif
-                        llp_decode(ctx);
-                    }
+        }
+        /////////////////////////////////////////////
+        // End of forward error correction block   //
+        /////////////////////////////////////////////
+
+        if (!rx->escape && c == HDLC_FLAG) {
+            // A frame ends at a flag that comes right
+            // after it. If the modem aborted since the
+            // last flag, the slicer missed the closing
+            // flag, and this one may belong to the next
+            // transmission, long after another slicer
+            // delivered the frame. A frame is also
+            // always sent as whole blocks, so bytes
+            // after the last whole block are noise
+            // from a missed closing flag too. Either
+            // way, the frame is dropped. The flag
+            // itself was counted in readLength by the
+            // FEC block above.
+            bool whole = rx->readLength == 0 || (rx->readLength - 1) % LLP_INTERLEAVE_SIZE == 0;
+
+            if (rx->sync && whole && rx->frame_len >= LLP_MIN_FRAME_LENGTH) {
+                if (PASSALL || rx->crc_in == LLP_CRC_CORRECT) {
+                    #if OPEN_SQUELCH == true
+                        LED_RX_ON();
+                    #endif
+                    llp_decode(ctx, rx);
                 }
-                ctx->sync = true;
-                ctx->crc_in = CRC_CCIT_INIT_VAL;
-                ctx->frame_len = 0;
-                ctx->readLength = 0;
-                ctx->correctionsMade = 0;
-                continue;
             }
+            rx->sync = llp_rxSlot(ctx, rx);
+            rx->crc_in = CRC_CCIT_INIT_VAL;
+            rx->frame_len = 0;
+            rx->readLength = 0;
+            rx->correctionsMade = 0;
+            rx->weakNext = 0;
+            return;
+        }
 
-            if (!ctx->escape && c == HDLC_RESET) {
-                ctx->sync = false;
-                continue;
-            }
+        if (!rx->escape && c == HDLC_RESET) {
+            rx->sync = false;
+            return;
+        }
 
-            if (!ctx->escape && c == LLP_ESC) {
-                ctx->escape = true;
-                continue;
-            }
+        if (!rx->escape && c == LLP_ESC) {
+            rx->escape = true;
+            return;
+        }
 
-            if (ctx->sync) {
-                if (ctx->frame_len < LLP_MAX_FRAME_LENGTH) {
-                    ctx->buf[ctx->frame_len++] = c;
-                } else {
-                    ctx->sync = false;
-                }
+        if (rx->sync) {
+            if (rx->frame_len < LLP_RX_BUFLEN) {
+                rx->buf[rx->frame_len++] = c;
+            } else {
+                rx->sync = false;
             }
-            ctx->escape = false;
         }
+        rx->escape = false;
     #endif
 }
 
-static void llp_putchar(LLPCtx *ctx, uint8_t c) {
-    if (c == HDLC_FLAG || c == HDLC_RESET || c == LLP_ESC) fputc(LLP_ESC, ctx->ch);
-    fputc(c, ctx->ch);
+// Reads everything the modem slicers have
+// received so far, straight out of their RX
+// buffers
+void llp_poll(LLPCtx *ctx) {
+    for (uint8_t slicer = 0; slicer < CONFIG_AFSK_SLICERS; slicer++) {
+        LLPRx *rx = &ctx->rx[slicer];
+        const uint8_t *span;
+        uint8_t n;
+        while ((n = afsk_readspan(ctx->modem, slicer, &span)) != 0) {
+            for (uint8_t i = 0; i < n; i++) {
+                llp_parse(ctx, rx, span[i]);
+            }
+            afsk_skip(ctx->modem, slicer, n);
+        }
+    }
+}
+
+// Writes a byte to the modem, escaping it if it
+// looks like a control character. Returns how
+// many bytes were actually written to out.
+static uint8_t llp_escape(uint8_t *out, uint8_t c) {
+    if (c == HDLC_FLAG || c == HDLC_RESET || c == LLP_ESC) {
+        out[0] = LLP_ESC;
+        out[1] = c;
+        return 2;
+    }
+    out[0] = c;
+    return 1;
+}
+
+static void llp_putflag(LLPCtx *ctx) {
+    uint8_t flag = HDLC_FLAG;
+    afsk_write(ctx->modem, &flag, 1);
 }
 
 static void llp_sendchar(LLPCtx *ctx, uint8_t c) {
@@ -281,7 +356,7 @@ static void llp_sendchar(LLPCtx *ctx, uint8_t c) {
     ctx->crc_out = update_crc_ccit(c, ctx->crc_out);
 
     if (sendParityBlock) {
-        uint8_t p = llpParityBlock(lastByte, c);
+        uint8_t p = llp_fec_encode_pair(lastByte, c);
         llpInterleave(ctx, p);
     }
 
@@ -289,58 +364,64 @@ static void llp_sendchar(LLPCtx *ctx, uint8_t c) {
     sendParityBlock ^= true;
 }
 
-void llp_sendaddress(LLPCtx *ctx, LLPAddress *address) {
-    llp_sendchar(ctx, address->network >> 8);
-    llp_sendchar(ctx, address->network & 0xff);
-    llp_sendchar(ctx, address->host >> 8);
-    llp_sendchar(ctx, address->host & 0xff);
-}
-
-void llp_broadcast(LLPCtx *ctx, const void *_buf, size_t len) {
-    llp_send(ctx, &broadcast_address, _buf, len);
+size_t llp_broadcastStart(LLPCtx *ctx, size_t len, uint8_t *header) {
+    return llp_sendStart(ctx, &broadcast_address, len, header);
 }
 
-void llp_send(LLPCtx *ctx, LLPAddress *dst, const void *_buf, size_t len) {
+// Starts a frame with len bytes of payload. The
+// header and padding bytes are written to the
+// header buffer, which must have room for
+// LLP_MAX_HEADER_LENGTH bytes, and must then be
+// passed to llp_sendData, followed by the payload
+// and finally llp_sendEnd. This lets the caller
+// feed the modem a little at a time, instead of
+// blocking until the whole frame is encoded.
+// Nothing here waits for the modem, so before
+// every call there must be LLP_SEND_CHUNK_SPACE
+// bytes free in its TX FIFO.
+size_t llp_sendStart(LLPCtx *ctx, LLPAddress *dst, size_t len, uint8_t *header) {
     ctx->ready_for_data = false;
     ctx->interleaveCounter = 0;
     ctx->crc_out = CRC_CCIT_INIT_VAL;
-    uint8_t *buffer = (uint8_t*)_buf;
-
-    LLPHeader header;
-    memset(&header, 0, sizeof(header));
 
     LLPAddress *localAddress = ctx->address;
-    header.src.network = localAddress->network;
-    header.src.host    = localAddress->host;
-    header.dst.network = dst->network;
-    header.dst.host    = dst->host;
-    header.flags       = 0x00;
-    header.padding     = (len + LLP_HEADER_SIZE + LLP_CRC_SIZE) % LLP_DATA_BLOCK_SIZE;
-    if (header.padding != 0) {
-        header.padding = LLP_DATA_BLOCK_SIZE - header.padding;
+    uint8_t padding = (len + LLP_HEADER_SIZE + LLP_CRC_SIZE) % LLP_DATA_BLOCK_SIZE;
+    if (padding != 0) {
+        padding = LLP_DATA_BLOCK_SIZE - padding;
     }
 
-    // Transmit the HDLC_FLAG to signify start of TX
-    fputc(HDLC_FLAG, ctx->ch);
-
-    // Transmit source & destination addresses
-    llp_sendaddress(ctx, &header.src);
-    llp_sendaddress(ctx, &header.dst);
+    // Source & destination addresses
+    size_t i = 0;
+    header[i++] = localAddress->network >> 8;
+    header[i++] = localAddress->network & 0xff;
+    header[i++] = localAddress->host >> 8;
+    header[i++] = localAddress->host & 0xff;
+    header[i++] = dst->network >> 8;
+    header[i++] = dst->network & 0xff;
+    header[i++] = dst->host >> 8;
+    header[i++] = dst->host & 0xff;
+
+    // Header flags & padding count, and the
+    // padding itself
+    header[i++] = 0x00;
+    header[i++] = padding;
+    while (padding--) {
+        header[i++] = 0x00;
+    }
 
-    // Transmit header flags & padding count
-    llp_sendchar(ctx, header.flags);
-    llp_sendchar(ctx, header.padding);
+    // Transmit the HDLC_FLAG to signify start of TX
+    llp_putflag(ctx);
 
-    // Transmit padding
-    while (header.padding--) {
-        llp_sendchar(ctx, 0x00);
-    }
+    return i;
+}
 
-    // Transmit payload
+void llp_sendData(LLPCtx *ctx, const uint8_t *buf, size_t len) {
     while (len--) {
-        llp_sendchar(ctx, *buffer++);
+        llp_sendchar(ctx, *buf++);
     }
+}
 
+void llp_sendEnd(LLPCtx *ctx) {
     // Send CRC checksum
     uint8_t crcl = (ctx->crc_out & 0xff) ^ 0xff;
     uint8_t crch = (ctx->crc_out >> 8) ^ 0xff;
@@ -349,33 +430,20 @@ void llp_send(LLPCtx *ctx, LLPAddress *dst, const void *_buf, size_t len) {
 
     // And transmit a HDLC_FLAG to signify
     // end of the transmission.
-    fputc(HDLC_FLAG, ctx->ch);
+    llp_putflag(ctx);
     ctx->ready_for_data = true;
 }
 
-void llp_sendRaw(LLPCtx *ctx, const void *_buf, size_t len) {
-    ctx->ready_for_data = false;
-    ctx->crc_out = CRC_CCIT_INIT_VAL;
-    fputc(HDLC_FLAG, ctx->ch);
-    const uint8_t *buf = (const uint8_t *)_buf;
-    while (len--) llp_putchar(ctx, *buf++);
-
-    uint8_t crcl = (ctx->crc_out & 0xff) ^ 0xff;
-    uint8_t crch = (ctx->crc_out >> 8) ^ 0xff;
-    llp_putchar(ctx, crcl);
-    llp_putchar(ctx, crch);
-
-    fputc(HDLC_FLAG, ctx->ch);
-
-    ctx->ready_for_data = true;
-}
-
-void llp_init(LLPCtx *ctx, LLPAddress *address, FILE *channel, llp_callback_t hook) {
+void llp_init(LLPCtx *ctx, LLPAddress *address, Afsk *modem, llp_callback_t hook) {
     memset(ctx, 0, sizeof(*ctx));
-    ctx->ch = channel;
+    ctx->modem = modem;
     ctx->hook = hook;
     ctx->address = address;
-    ctx->crc_in = ctx->crc_out = CRC_CCIT_INIT_VAL;
+    ctx->slotsFree = (1 << CONFIG_LLP_RX_SLOTS) - 1;
+    ctx->crc_out = CRC_CCIT_INIT_VAL;
+    for (uint8_t i = 0; i < CONFIG_AFSK_SLICERS; i++) {
+        ctx->rx[i].crc_in = CRC_CCIT_INIT_VAL;
+    }
     ctx->ready_for_data = true;
 
     memset(&broadcast_address, 0, sizeof(broadcast_address));
@@ -383,36 +451,151 @@ void llp_init(LLPCtx *ctx, LLPAddress *address, FILE *channel, llp_callback_t ho
     broadcast_address.host    = LLP_ADDR_BROADCAST;
 }
 
-// This function calculates and returns a parity
-// byte for two input bytes. The parity byte is
-// used for correcting errors in the transmission.
 // The error correction algorithm is a standard
-// (12,8) Hamming code.
-inline bool BIT(uint8_t byte, int n) { return ((byte & _BV(n-1))>>(n-1)); }
-uint8_t llpParityBlock(uint8_t first, uint8_t other) {
-    uint8_t parity = 0x00;
-
-    parity =     ((BIT(first, 1) ^ BIT(first, 2) ^ BIT(first, 4) ^ BIT(first, 5) ^ BIT(first, 7))) +
-                ((BIT(first, 1) ^ BIT(first, 3) ^ BIT(first, 4) ^ BIT(first, 6) ^ BIT(first, 7))<<1) +
-                ((BIT(first, 2) ^ BIT(first, 3) ^ BIT(first, 4) ^ BIT(first, 8))<<2) +
-                ((BIT(first, 5) ^ BIT(first, 6) ^ BIT(first, 7) ^ BIT(first, 8))<<3) +
-
-                ((BIT(other, 1) ^ BIT(other, 2) ^ BIT(other, 4) ^ BIT(other, 5) ^ BIT(other, 7))<<4) +
-                ((BIT(other, 1) ^ BIT(other, 3) ^ BIT(other, 4) ^ BIT(other, 6) ^ BIT(other, 7))<<5) +
-                ((BIT(other, 2) ^ BIT(other, 3) ^ BIT(other, 4) ^ BIT(other, 8))<<6) +
-                ((BIT(other, 5) ^ BIT(other, 6) ^ BIT(other, 7) ^ BIT(other, 8))<<7);
-
-    return parity;
+// (12,8) Hamming code. Every two data bytes get
+// one parity byte, where the low nibble is the
+// four parity bits for the first byte, and the
+// high nibble is the parity bits for the other.
+// The parity bits of any byte are looked up in
+// this table.
+static const uint8_t fec_parity_table[256] PROGMEM = {
+    0x0, 0x3, 0x5, 0x6, 0x6, 0x5, 0x3, 0x0, 0x7, 0x4, 0x2, 0x1, 0x1, 0x2, 0x4, 0x7,
+    0x9, 0xa, 0xc, 0xf, 0xf, 0xc, 0xa, 0x9, 0xe, 0xd, 0xb, 0x8, 0x8, 0xb, 0xd, 0xe,
+    0xa, 0x9, 0xf, 0xc, 0xc, 0xf, 0x9, 0xa, 0xd, 0xe, 0x8, 0xb, 0xb, 0x8, 0xe, 0xd,
+    0x3, 0x0, 0x6, 0x5, 0x5, 0x6, 0x0, 0x3, 0x4, 0x7, 0x1, 0x2, 0x2, 0x1, 0x7, 0x4,
+    0xb, 0x8, 0xe, 0xd, 0xd, 0xe, 0x8, 0xb, 0xc, 0xf, 0x9, 0xa, 0xa, 0x9, 0xf, 0xc,
+    0x2, 0x1, 0x7, 0x4, 0x4, 0x7, 0x1, 0x2, 0x5, 0x6, 0x0, 0x3, 0x3, 0x0, 0x6, 0x5,
+    0x1, 0x2, 0x4, 0x7, 0x7, 0x4, 0x2, 0x1, 0x6, 0x5, 0x3, 0x0, 0x0, 0x3, 0x5, 0x6,
+    0x8, 0xb, 0xd, 0xe, 0xe, 0xd, 0xb, 0x8, 0xf, 0xc, 0xa, 0x9, 0x9, 0xa, 0xc, 0xf,
+    0xc, 0xf, 0x9, 0xa, 0xa, 0x9, 0xf, 0xc, 0xb, 0x8, 0xe, 0xd, 0xd, 0xe, 0x8, 0xb,
+    0x5, 0x6, 0x0, 0x3, 0x3, 0x0, 0x6, 0x5, 0x2, 0x1, 0x7, 0x4, 0x4, 0x7, 0x1, 0x2,
+    0x6, 0x5, 0x3, 0x0, 0x0, 0x3, 0x5, 0x6, 0x1, 0x2, 0x4, 0x7, 0x7, 0x4, 0x2, 0x1,
+    0xf, 0xc, 0xa, 0x9, 0x9, 0xa, 0xc, 0xf, 0x8, 0xb, 0xd, 0xe, 0xe, 0xd, 0xb, 0x8,
+    0x7, 0x4, 0x2, 0x1, 0x1, 0x2, 0x4, 0x7, 0x0, 0x3, 0x5, 0x6, 0x6, 0x5, 0x3, 0x0,
+    0xe, 0xd, 0xb, 0x8, 0x8, 0xb, 0xd, 0xe, 0x9, 0xa, 0xc, 0xf, 0xf, 0xc, 0xa, 0x9,
+    0xd, 0xe, 0x8, 0xb, 0xb, 0x8, 0xe, 0xd, 0xa, 0x9, 0xf, 0xc, 0xc, 0xf, 0x9, 0xa,
+    0x4, 0x7, 0x1, 0x2, 0x2, 0x1, 0x7, 0x4, 0x3, 0x0, 0x6, 0x5, 0x5, 0x6, 0x0, 0x3
+};
+
+// XORing the calculated parity nibble with the
+// received one gives us what is called the
+// "syndrome". This number tells us if we had any
+// errors during transmission, and if so where
+// they are. This table maps each syndrome to the
+// data bit that should be flipped. A syndrome of
+// 1, 2, 4 or 8 means the error was in the parity
+// bits themselves, so there is nothing to correct,
+// and 13 to 15 are not valid positions.
+static const uint8_t fec_correction_table[16] PROGMEM = {
+    0x00, 0x00, 0x00, 0x01, 0x00, 0x02, 0x04, 0x08, 0x00, 0x10, 0x20, 0x40, 0x80, 0x00, 0x00, 0x00
+};
+
+uint8_t llp_fec_encode_pair(uint8_t first, uint8_t other) {
+    return pgm_read_byte(&fec_parity_table[first]) | (pgm_read_byte(&fec_parity_table[other]) << 4);
+}
+
+// Checks a block of two data bytes against its
+// received parity byte, and corrects a single bit
+// error in each data byte if there is one. Returns
+// the number of corrections made.
+uint8_t llp_fec_decode_block(uint8_t *first, uint8_t *other, uint8_t parity) {
+    uint8_t syndrome = llp_fec_encode_pair(*first, *other) ^ parity;
+    if (syndrome == 0x00) return 0;
+
+    uint8_t corrections = 0;
+    uint8_t correction = pgm_read_byte(&fec_correction_table[syndrome & 0x0F]);
+    if (correction) {
+        *first ^= correction;
+        corrections++;
+    }
+
+    correction = pgm_read_byte(&fec_correction_table[syndrome >> 4]);
+    if (correction) {
+        *other ^= correction;
+        corrections++;
+    }
+
+    return corrections;
+}
+
+static uint8_t llp_popcount(uint16_t bits) {
+    uint8_t count = 0;
+    while (bits) {
+        bits &= bits - 1;
+        count++;
+    }
+    return count;
+}
+
+// Soft-decision decoding of a single (12,8)
+// codeword, which is a data byte and its four
+// parity bits, using the bits the demodulator
+// marked as weak. It works like a Chase decoder:
+// every combination of the weak bits is flipped,
+// and the result is run through the normal hard
+// decoder. Of the codewords that come out, we
+// keep the one closest to what was received,
+// where changing a weak bit costs less than
+// changing a strong one. If two bits are wrong
+// and both are weak, one of the combinations
+// flips both of them, and we get the right
+// codeword, where the hard decoder alone would
+// have "corrected" a third bit. Returns the
+// number of corrections made to the data byte.
+uint8_t llp_fec_decode_soft(uint8_t *data, uint8_t parity, uint8_t weakData, uint8_t weakParity) {
+    uint16_t received = *data | ((uint16_t)parity << 8);
+    uint16_t weak = weakData | ((uint16_t)weakParity << 8);
+
+    // Find the weak bits, up to LLP_SOFT_MAX_WEAK
+    // of them, starting from the data bits
+    uint16_t flips[LLP_SOFT_MAX_WEAK];
+    uint8_t n = 0;
+    for (uint8_t i = 0; i < 12 && n < LLP_SOFT_MAX_WEAK; i++) {
+        if (weak & (1 << i)) flips[n++] = 1 << i;
+    }
+
+    uint16_t best = received;
+    uint8_t bestCost = 0xFF;
+    for (uint8_t pattern = 0; pattern < (1 << n); pattern++) {
+        uint16_t word = received;
+        for (uint8_t i = 0; i < n; i++) {
+            if (pattern & (1 << i)) word ^= flips[i];
+        }
+
+        // Run the flipped word through the hard
+        // decoder. A syndrome of a single bit is an
+        // error in the parity bits, and syndromes
+        // that don't point at any bit mean there are
+        // more errors than the decoder can handle.
+        uint8_t syndrome = pgm_read_byte(&fec_parity_table[word & 0xFF]) ^ (word >> 8);
+        if (syndrome != 0) {
+            if ((syndrome & (syndrome - 1)) == 0) {
+                word ^= (uint16_t)syndrome << 8;
+            } else {
+                uint8_t correction = pgm_read_byte(&fec_correction_table[syndrome]);
+                if (correction == 0) continue;
+                word ^= correction;
+            }
+        }
+
+        uint16_t changed = word ^ received;
+        uint8_t cost = llp_popcount(changed & weak) + 3 * llp_popcount(changed & ~weak);
+        if (cost < bestCost) {
+            bestCost = cost;
+            best = word;
+        }
+    }
+
+    if (bestCost == 0xFF || (uint8_t)best == *data) return 0;
+    *data = best & 0xFF;
+    return 1;
 }
 
 // Following is the functions responsible
 // for interleaving and deinterleaving
 // blocks of data. The interleaving table
 // for 3-byte interleaving is also included.
-// The table for 12-byte is much simpler,
-// and should be inferable from looking
-// at the function.
-
+//
 ///////////////////////////////
 // Interleave-table (3-byte) //
 ///////////////////////////////
@@ -429,268 +612,64 @@ uint8_t llpParityBlock(uint8_t first, uint8_t other) {
 // 11144477 22255578 63336688
 //
 ///////////////////////////////
+//
+// A block of LLP_INTERLEAVE_SIZE bytes is made
+// of groups of two data bytes and one parity byte.
+// The data bytes and the parity bytes are each
+// interleaved on their own, and the interleaved
+// data is sent first, followed by the parity.
+//
+// Each part is interleaved by writing its bits
+// into a matrix of 8 rows, filling one row at a
+// time, and then sending the columns. With k
+// bytes the rows are k bits long, so each sent
+// byte gets one bit from every row, and bits that
+// were next to each other end up k bits apart.
+// For the 8 data bytes of a 12 byte block this is
+// simply transposing the 8x8 bit matrix. The bit
+// shuffling itself is in LLP-interleave.c.
 
 void llpInterleave(LLPCtx *ctx, uint8_t byte) {
     ctx->interleaveOut[ctx->interleaveCounter] = byte;
     ctx->interleaveCounter++;
-    if (!DISABLE_INTERLEAVE) {
-        if (ctx->interleaveCounter == LLP_INTERLEAVE_SIZE) {
+    if (ctx->interleaveCounter == LLP_INTERLEAVE_SIZE) {
+        if (!DISABLE_INTERLEAVE) {
             // We have the bytes we need for interleaving
             // in the buffer and are ready to interleave them.
-
-            uint8_t a = (GET_BIT(ctx->interleaveOut[0], 1) << 7) +
-                        (GET_BIT(ctx->interleaveOut[1], 1) << 6) +
-                        (GET_BIT(ctx->interleaveOut[3], 1) << 5) +
-                        (GET_BIT(ctx->interleaveOut[4], 1) << 4) +
-                        (GET_BIT(ctx->interleaveOut[6], 1) << 3) +
-                        (GET_BIT(ctx->interleaveOut[7], 1) << 2) +
-                        (GET_BIT(ctx->interleaveOut[9], 1) << 1) +
-                        (GET_BIT(ctx->interleaveOut[10],1));
-            llp_putchar(ctx, a);
-
-            uint8_t b = (GET_BIT(ctx->interleaveOut[0], 2) << 7) +
-                        (GET_BIT(ctx->interleaveOut[1], 2) << 6) +
-                        (GET_BIT(ctx->interleaveOut[3], 2) << 5) +
-                        (GET_BIT(ctx->interleaveOut[4], 2) << 4) +
-                        (GET_BIT(ctx->interleaveOut[6], 2) << 3) +
-                        (GET_BIT(ctx->interleaveOut[7], 2) << 2) +
-                        (GET_BIT(ctx->interleaveOut[9], 2) << 1) +
-                        (GET_BIT(ctx->interleaveOut[10],2));
-            llp_putchar(ctx, b);
-
-            uint8_t c = (GET_BIT(ctx->interleaveOut[0], 3) << 7) +
-                        (GET_BIT(ctx->interleaveOut[1], 3) << 6) +
-                        (GET_BIT(ctx->interleaveOut[3], 3) << 5) +
-                        (GET_BIT(ctx->interleaveOut[4], 3) << 4) +
-                        (GET_BIT(ctx->interleaveOut[6], 3) << 3) +
-                        (GET_BIT(ctx->interleaveOut[7], 3) << 2) +
-                        (GET_BIT(ctx->interleaveOut[9], 3) << 1) +
-                        (GET_BIT(ctx->interleaveOut[10],3));
-            llp_putchar(ctx, c);
-
-            uint8_t d = (GET_BIT(ctx->interleaveOut[0], 4) << 7) +
-                        (GET_BIT(ctx->interleaveOut[1], 4) << 6) +
-                        (GET_BIT(ctx->interleaveOut[3], 4) << 5) +
-                        (GET_BIT(ctx->interleaveOut[4], 4) << 4) +
-                        (GET_BIT(ctx->interleaveOut[6], 4) << 3) +
-                        (GET_BIT(ctx->interleaveOut[7], 4) << 2) +
-                        (GET_BIT(ctx->interleaveOut[9], 4) << 1) +
-                        (GET_BIT(ctx->interleaveOut[10],4));
-            llp_putchar(ctx, d);
-
-            uint8_t e = (GET_BIT(ctx->interleaveOut[0], 5) << 7) +
-                        (GET_BIT(ctx->interleaveOut[1], 5) << 6) +
-                        (GET_BIT(ctx->interleaveOut[3], 5) << 5) +
-                        (GET_BIT(ctx->interleaveOut[4], 5) << 4) +
-                        (GET_BIT(ctx->interleaveOut[6], 5) << 3) +
-                        (GET_BIT(ctx->interleaveOut[7], 5) << 2) +
-                        (GET_BIT(ctx->interleaveOut[9], 5) << 1) +
-                        (GET_BIT(ctx->interleaveOut[10],5));
-            llp_putchar(ctx, e);
-
-            uint8_t f = (GET_BIT(ctx->interleaveOut[0], 6) << 7) +
-                        (GET_BIT(ctx->interleaveOut[1], 6) << 6) +
-                        (GET_BIT(ctx->interleaveOut[3], 6) << 5) +
-                        (GET_BIT(ctx->interleaveOut[4], 6) << 4) +
-                        (GET_BIT(ctx->interleaveOut[6], 6) << 3) +
-                        (GET_BIT(ctx->interleaveOut[7], 6) << 2) +
-                        (GET_BIT(ctx->interleaveOut[9], 6) << 1) +
-                        (GET_BIT(ctx->interleaveOut[10],6));
-            llp_putchar(ctx, f);
-
-            uint8_t g = (GET_BIT(ctx->interleaveOut[0], 7) << 7) +
-                        (GET_BIT(ctx->interleaveOut[1], 7) << 6) +
-                        (GET_BIT(ctx->interleaveOut[3], 7) << 5) +
-                        (GET_BIT(ctx->interleaveOut[4], 7) << 4) +
-                        (GET_BIT(ctx->interleaveOut[6], 7) << 3) +
-                        (GET_BIT(ctx->interleaveOut[7], 7) << 2) +
-                        (GET_BIT(ctx->interleaveOut[9], 7) << 1) +
-                        (GET_BIT(ctx->interleaveOut[10],7));
-            llp_putchar(ctx, g);
-
-            uint8_t h = (GET_BIT(ctx->interleaveOut[0], 8) << 7) +
-                        (GET_BIT(ctx->interleaveOut[1], 8) << 6) +
-                        (GET_BIT(ctx->interleaveOut[3], 8) << 5) +
-                        (GET_BIT(ctx->interleaveOut[4], 8) << 4) +
-                        (GET_BIT(ctx->interleaveOut[6], 8) << 3) +
-                        (GET_BIT(ctx->interleaveOut[7], 8) << 2) +
-                        (GET_BIT(ctx->interleaveOut[9], 8) << 1) +
-                        (GET_BIT(ctx->interleaveOut[10],8));
-            llp_putchar(ctx, h);
-
-            uint8_t p = (GET_BIT(ctx->interleaveOut[2], 1) << 7) +
-                        (GET_BIT(ctx->interleaveOut[2], 5) << 6) +
-                        (GET_BIT(ctx->interleaveOut[5], 1) << 5) +
-                        (GET_BIT(ctx->interleaveOut[5], 5) << 4) +
-                        (GET_BIT(ctx->interleaveOut[8], 1) << 3) +
-                        (GET_BIT(ctx->interleaveOut[8], 5) << 2) +
-                        (GET_BIT(ctx->interleaveOut[11],1) << 1) +
-                        (GET_BIT(ctx->interleaveOut[11],5));
-            llp_putchar(ctx, p);
-
-            uint8_t q = (GET_BIT(ctx->interleaveOut[2], 2) << 7) +
-                        (GET_BIT(ctx->interleaveOut[2], 6) << 6) +
-                        (GET_BIT(ctx->interleaveOut[5], 2) << 5) +
-                        (GET_BIT(ctx->interleaveOut[5], 6) << 4) +
-                        (GET_BIT(ctx->interleaveOut[8], 2) << 3) +
-                        (GET_BIT(ctx->interleaveOut[8], 6) << 2) +
-                        (GET_BIT(ctx->interleaveOut[11],2) << 1) +
-                        (GET_BIT(ctx->interleaveOut[11],6));
-            llp_putchar(ctx, q);
-
-            uint8_t s = (GET_BIT(ctx->interleaveOut[2], 3) << 7) +
-                        (GET_BIT(ctx->interleaveOut[2], 7) << 6) +
-                        (GET_BIT(ctx->interleaveOut[5], 3) << 5) +
-                        (GET_BIT(ctx->interleaveOut[5], 7) << 4) +
-                        (GET_BIT(ctx->interleaveOut[8], 3) << 3) +
-                        (GET_BIT(ctx->interleaveOut[8], 7) << 2) +
-                        (GET_BIT(ctx->interleaveOut[11],3) << 1) +
-                        (GET_BIT(ctx->interleaveOut[11],7));
-            llp_putchar(ctx, s);
-
-            uint8_t t = (GET_BIT(ctx->interleaveOut[2], 4) << 7) +
-                        (GET_BIT(ctx->interleaveOut[2], 8) << 6) +
-                        (GET_BIT(ctx->interleaveOut[5], 4) << 5) +
-                        (GET_BIT(ctx->interleaveOut[5], 8) << 4) +
-                        (GET_BIT(ctx->interleaveOut[8], 4) << 3) +
-                        (GET_BIT(ctx->interleaveOut[8], 8) << 2) +
-                        (GET_BIT(ctx->interleaveOut[11],4) << 1) +
-                        (GET_BIT(ctx->interleaveOut[11],8));
-            llp_putchar(ctx, t);
-
-            ctx->interleaveCounter = 0;
-        }
-    } else {
-        if (ctx->interleaveCounter == LLP_INTERLEAVE_SIZE) {
-            for (int i = 0; i < LLP_INTERLEAVE_SIZE; i++) {
-                llp_putchar(ctx, ctx->interleaveOut[i]);
+            uint8_t data[LLP_DATA_BLOCK_SIZE];
+            uint8_t parity[LLP_PARITY_BLOCK_SIZE];
+            for (uint8_t i = 0; i < LLP_PARITY_BLOCK_SIZE; i++) {
+                data[i*2]   = ctx->interleaveOut[i*3];
+                data[i*2+1] = ctx->interleaveOut[i*3+1];
+                parity[i]   = ctx->interleaveOut[i*3+2];
             }
-            ctx->interleaveCounter = 0;
+
+            llp_interleaveBits(data, ctx->interleaveOut, LLP_DATA_BLOCK_SIZE);
+            llp_interleaveBits(parity, &ctx->interleaveOut[LLP_DATA_BLOCK_SIZE], LLP_PARITY_BLOCK_SIZE);
         }
 
+        // The whole block is escaped and handed to
+        // the modem in one go
+        uint8_t out[2*LLP_INTERLEAVE_SIZE];
+        uint8_t len = 0;
+        for (uint8_t i = 0; i < LLP_INTERLEAVE_SIZE; i++) {
+            len += llp_escape(&out[len], ctx->interleaveOut[i]);
+        }
+        afsk_write(ctx->modem, out, len);
+        ctx->interleaveCounter = 0;
     }
 }
 
-
-void llpDeinterleave(LLPCtx *ctx) {
-    uint8_t a = (GET_BIT(ctx->interleaveIn[0], 1) << 7) +
-                (GET_BIT(ctx->interleaveIn[1], 1) << 6) +
-                (GET_BIT(ctx->interleaveIn[2], 1) << 5) +
-                (GET_BIT(ctx->interleaveIn[3], 1) << 4) +
-                (GET_BIT(ctx->interleaveIn[4], 1) << 3) +
-                (GET_BIT(ctx->interleaveIn[5], 1) << 2) +
-                (GET_BIT(ctx->interleaveIn[6], 1) << 1) +
-                (GET_BIT(ctx->interleaveIn[7], 1));
-
-    uint8_t b = (GET_BIT(ctx->interleaveIn[0], 2) << 7) +
-                (GET_BIT(ctx->interleaveIn[1], 2) << 6) +
-                (GET_BIT(ctx->interleaveIn[2], 2) << 5) +
-                (GET_BIT(ctx->interleaveIn[3], 2) << 4) +
-                (GET_BIT(ctx->interleaveIn[4], 2) << 3) +
-                (GET_BIT(ctx->interleaveIn[5], 2) << 2) +
-                (GET_BIT(ctx->interleaveIn[6], 2) << 1) +
-                (GET_BIT(ctx->interleaveIn[7], 2));
-
-    uint8_t p = (GET_BIT(ctx->interleaveIn[8], 1) << 7) +
-                (GET_BIT(ctx->interleaveIn[9], 1) << 6) +
-                (GET_BIT(ctx->interleaveIn[10],1) << 5) +
-                (GET_BIT(ctx->interleaveIn[11],1) << 4) +
-                (GET_BIT(ctx->interleaveIn[8], 2) << 3) +
-                (GET_BIT(ctx->interleaveIn[9], 2) << 2) +
-                (GET_BIT(ctx->interleaveIn[10],2) << 1) +
-                (GET_BIT(ctx->interleaveIn[11],2));
-
-    uint8_t c = (GET_BIT(ctx->interleaveIn[0], 3) << 7) +
-                (GET_BIT(ctx->interleaveIn[1], 3) << 6) +
-                (GET_BIT(ctx->interleaveIn[2], 3) << 5) +
-                (GET_BIT(ctx->interleaveIn[3], 3) << 4) +
-                (GET_BIT(ctx->interleaveIn[4], 3) << 3) +
-                (GET_BIT(ctx->interleaveIn[5], 3) << 2) +
-                (GET_BIT(ctx->interleaveIn[6], 3) << 1) +
-                (GET_BIT(ctx->interleaveIn[7], 3));
-
-    uint8_t d = (GET_BIT(ctx->interleaveIn[0], 4) << 7) +
-                (GET_BIT(ctx->interleaveIn[1], 4) << 6) +
-                (GET_BIT(ctx->interleaveIn[2], 4) << 5) +
-                (GET_BIT(ctx->interleaveIn[3], 4) << 4) +
-                (GET_BIT(ctx->interleaveIn[4], 4) << 3) +
-                (GET_BIT(ctx->interleaveIn[5], 4) << 2) +
-                (GET_BIT(ctx->interleaveIn[6], 4) << 1) +
-                (GET_BIT(ctx->interleaveIn[7], 4));
-
-    uint8_t q = (GET_BIT(ctx->interleaveIn[8], 3) << 7) +
-                (GET_BIT(ctx->interleaveIn[9], 3) << 6) +
-                (GET_BIT(ctx->interleaveIn[10],3) << 5) +
-                (GET_BIT(ctx->interleaveIn[11],3) << 4) +
-                (GET_BIT(ctx->interleaveIn[8], 4) << 3) +
-                (GET_BIT(ctx->interleaveIn[9], 4) << 2) +
-                (GET_BIT(ctx->interleaveIn[10],4) << 1) +
-                (GET_BIT(ctx->interleaveIn[11],4));
-
-    uint8_t e = (GET_BIT(ctx->interleaveIn[0], 5) << 7) +
-                (GET_BIT(ctx->interleaveIn[1], 5) << 6) +
-                (GET_BIT(ctx->interleaveIn[2], 5) << 5) +
-                (GET_BIT(ctx->interleaveIn[3], 5) << 4) +
-                (GET_BIT(ctx->interleaveIn[4], 5) << 3) +
-                (GET_BIT(ctx->interleaveIn[5], 5) << 2) +
-                (GET_BIT(ctx->interleaveIn[6], 5) << 1) +
-                (GET_BIT(ctx->interleaveIn[7], 5));
-
-    uint8_t f = (GET_BIT(ctx->interleaveIn[0], 6) << 7) +
-                (GET_BIT(ctx->interleaveIn[1], 6) << 6) +
-                (GET_BIT(ctx->interleaveIn[2], 6) << 5) +
-                (GET_BIT(ctx->interleaveIn[3], 6) << 4) +
-                (GET_BIT(ctx->interleaveIn[4], 6) << 3) +
-                (GET_BIT(ctx->interleaveIn[5], 6) << 2) +
-                (GET_BIT(ctx->interleaveIn[6], 6) << 1) +
-                (GET_BIT(ctx->interleaveIn[7], 6));
-
-    uint8_t s = (GET_BIT(ctx->interleaveIn[8], 5) << 7) +
-                (GET_BIT(ctx->interleaveIn[9], 5) << 6) +
-                (GET_BIT(ctx->interleaveIn[10],5) << 5) +
-                (GET_BIT(ctx->interleaveIn[11],5) << 4) +
-                (GET_BIT(ctx->interleaveIn[8], 6) << 3) +
-                (GET_BIT(ctx->interleaveIn[9], 6) << 2) +
-                (GET_BIT(ctx->interleaveIn[10],6) << 1) +
-                (GET_BIT(ctx->interleaveIn[11],6));
-
-    uint8_t g = (GET_BIT(ctx->interleaveIn[0], 7) << 7) +
-                (GET_BIT(ctx->interleaveIn[1], 7) << 6) +
-                (GET_BIT(ctx->interleaveIn[2], 7) << 5) +
-                (GET_BIT(ctx->interleaveIn[3], 7) << 4) +
-                (GET_BIT(ctx->interleaveIn[4], 7) << 3) +
-                (GET_BIT(ctx->interleaveIn[5], 7) << 2) +
-                (GET_BIT(ctx->interleaveIn[6], 7) << 1) +
-                (GET_BIT(ctx->interleaveIn[7], 7));
-
-    uint8_t h = (GET_BIT(ctx->interleaveIn[0], 8) << 7) +
-                (GET_BIT(ctx->interleaveIn[1], 8) << 6) +
-                (GET_BIT(ctx->interleaveIn[2], 8) << 5) +
-                (GET_BIT(ctx->interleaveIn[3], 8) << 4) +
-                (GET_BIT(ctx->interleaveIn[4], 8) << 3) +
-                (GET_BIT(ctx->interleaveIn[5], 8) << 2) +
-                (GET_BIT(ctx->interleaveIn[6], 8) << 1) +
-                (GET_BIT(ctx->interleaveIn[7], 8));
-
-    uint8_t t = (GET_BIT(ctx->interleaveIn[8], 7) << 7) +
-                (GET_BIT(ctx->interleaveIn[9], 7) << 6) +
-                (GET_BIT(ctx->interleaveIn[10],7) << 5) +
-                (GET_BIT(ctx->interleaveIn[11],7) << 4) +
-                (GET_BIT(ctx->interleaveIn[8], 8) << 3) +
-                (GET_BIT(ctx->interleaveIn[9], 8) << 2) +
-                (GET_BIT(ctx->interleaveIn[10],8) << 1) +
-                (GET_BIT(ctx->interleaveIn[11],8));
-
-    ctx->interleaveIn[0] =  a;
-    ctx->interleaveIn[1] =  b;
-    ctx->interleaveIn[2] =  p;
-    ctx->interleaveIn[3] =  c;
-    ctx->interleaveIn[4] =  d;
-    ctx->interleaveIn[5] =  q;
-    ctx->interleaveIn[6] =  e;
-    ctx->interleaveIn[7] =  f;
-    ctx->interleaveIn[8] =  s;
-    ctx->interleaveIn[9] =  g;
-    ctx->interleaveIn[10] = h;
-    ctx->interleaveIn[11] = t;
-}
\ No newline at end of file
+// Deinterleaves a received block in place
+void llpDeinterleave(uint8_t *block) {
+    uint8_t data[LLP_DATA_BLOCK_SIZE];
+    uint8_t parity[LLP_PARITY_BLOCK_SIZE];
+    llp_deinterleaveBits(block, data, LLP_DATA_BLOCK_SIZE);
+    llp_deinterleaveBits(&block[LLP_DATA_BLOCK_SIZE], parity, LLP_PARITY_BLOCK_SIZE);
+
+    for (uint8_t i = 0; i < LLP_PARITY_BLOCK_SIZE; i++) {
+        block[i*3]   = data[i*2];
+        block[i*3+1] = data[i*2+1];
+        block[i*3+2] = parity[i];
+    }
+}
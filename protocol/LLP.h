@@ -4,23 +4,88 @@
 #include <stdio.h>
 #include <stdbool.h>
 #include "device.h"
+#include "hardware/AFSK.h"
 
 #define LLP_ADDR_BROADCAST 0xFFFF
 
+// The interleave size can be any multiple of 3,
+// but both ends must of course agree on it. Larger
+// blocks spread the bits further apart, and can
+// correct longer error bursts. Frames are always
+// a whole number of blocks.
 #define LLP_INTERLEAVE_SIZE 12
 #define LLP_MIN_FRAME_LENGTH LLP_INTERLEAVE_SIZE
-#define LLP_MAX_FRAME_LENGTH 48 * LLP_INTERLEAVE_SIZE
+#define LLP_MAX_FRAME_LENGTH ((576 / LLP_INTERLEAVE_SIZE) * LLP_INTERLEAVE_SIZE)
 #define LLP_HEADER_SIZE 10
 #define LLP_CHECKSUM_SIZE 2
 #define LLP_MAX_DATA_SIZE LLP_MAX_FRAME_LENGTH - LLP_HEADER_SIZE - LLP_CHECKSUM_SIZE
 #define LLP_DATA_BLOCK_SIZE ((LLP_INTERLEAVE_SIZE/3)*2)
+#define LLP_PARITY_BLOCK_SIZE (LLP_INTERLEAVE_SIZE/3)
+
+// While a block is being received, its raw bytes
+// are stored after the decoded data, and they take
+// up more room than the data they decode to.
+#define LLP_RX_BUFLEN (LLP_MAX_FRAME_LENGTH + LLP_PARITY_BLOCK_SIZE)
+
+#if LLP_INTERLEAVE_SIZE % 3 != 0 || LLP_INTERLEAVE_SIZE < 3 || LLP_INTERLEAVE_SIZE > 48
+    #error Unsupported LLP interleave size!
+#endif
+
+#define LLP_MAX_HEADER_LENGTH (LLP_HEADER_SIZE + LLP_DATA_BLOCK_SIZE - 1)
+
+// When sending a frame in pieces, this is the most
+// data llp_sendData should get in one call, and
+// how much room there must be in the modem for the
+// encoded output. Every LLP_INTERLEAVE_SIZE encoded
+// bytes are written at once, and each of them can
+// be escaped, so with at most LLP_SEND_CHUNK bytes
+// we never write more than one such block. The
+// extra byte is for the HDLC flag in llp_sendEnd.
+#define LLP_SEND_CHUNK LLP_DATA_BLOCK_SIZE
+#define LLP_SEND_CHUNK_SPACE (2 * LLP_INTERLEAVE_SIZE + 1)
+
+// Received frames are queued until the host
+// output stage has sent them on. Each slot holds
+// one frame, and every modem slicer receives into
+// a free slot of its own while the others wait to
+// be sent. If there is no free slot, that slicer
+// pauses until one is released. Larger parts get
+// two slots for queued frames on top of one for
+// each slicer.
+//
+// The 328p only has RAM for a single slot. A slot
+// is LLP_MAX_FRAME_LENGTH (576) bytes, and along
+// with the 576 byte KISS pool and the serial and
+// modem buffers, a second one would not fit in
+// 2 KB. So on the 328p, a frame that starts while
+// the last one is still being written to the host
+// is lost. The README explains this limit.
+#ifndef CONFIG_LLP_RX_SLOTS
+    #if TARGET_CPU == m328p
+        #define CONFIG_LLP_RX_SLOTS 1
+    #else
+        #define CONFIG_LLP_RX_SLOTS (CONFIG_AFSK_SLICERS + 2)
+    #endif
+#endif
+
+#if CONFIG_LLP_RX_SLOTS < CONFIG_AFSK_SLICERS || CONFIG_LLP_RX_SLOTS > 8
+    #error Unsupported number of LLP RX slots!
+#endif
+
+// The soft-decision decoder tries every way of
+// flipping the weak bits in a codeword, so the
+// work doubles with each one. If there are more
+// weak bits than this, only the first ones are
+// tried.
+#define LLP_SOFT_MAX_WEAK 3
 
 #define LLP_CRC_SIZE 2
 #define LLP_CRC_CORRECT  0xF0B8
 
 struct LLPCtx;     // Forward declarations
+struct LLPMsg;
 
-typedef void (*llp_callback_t)(struct LLPCtx *ctx);
+typedef void (*llp_callback_t)(struct LLPCtx *ctx, const struct LLPMsg *msg);
 
 typedef struct LLPAddress {
     uint16_t network;
@@ -40,33 +105,56 @@ typedef struct LLPMsg {
     size_t len;
 } LLPMsg;
 
-typedef struct LLPCtx {
-    uint8_t buf[LLP_MAX_FRAME_LENGTH];
-    FILE *ch;
-    LLPAddress *address;
+// Receiver state for one of the modem slicers
+typedef struct LLPRx {
+    uint8_t *buf;                                   // The slot being received into, or NULL
     size_t frame_len;
     size_t readLength;
     uint16_t crc_in;
-    uint16_t crc_out;
-    uint8_t calculatedParity;
     long correctionsMade;
-    llp_callback_t hook;
     bool sync;
     bool escape;
+    bool softMask;                                  // The next byte is a mask of weak bits
+    uint8_t weakNext;                               // Weak bits of the next data byte
+    uint8_t interleaveIn[LLP_INTERLEAVE_SIZE];      // A buffer for storing interleaved bytes before they are deinterleaved
+    uint8_t weakIn[LLP_INTERLEAVE_SIZE];            // The weak bits of those bytes
+} LLPRx;
+
+typedef struct LLPCtx {
+    uint8_t slots[CONFIG_LLP_RX_SLOTS][LLP_RX_BUFLEN];         // Storage for received frames
+    LLPMsg msgs[CONFIG_LLP_RX_SLOTS];                         // The queued frames, pointing into the slots
+    uint8_t msgSlot[CONFIG_LLP_RX_SLOTS];                     // Which slot each queued frame is in
+    uint8_t slotHead;                                         // Oldest queued frame
+    uint8_t slotCount;                                        // Number of queued frames
+    uint8_t slotsFree;                                        // One bit for each slot that is not in use
+    LLPRx rx[CONFIG_AFSK_SLICERS];                            // One receiver for each modem slicer
+#if CONFIG_AFSK_SLICERS > 1
+    size_t lastLength;                                        // Length, FCS and time of the last
+    uint16_t lastFcs;                                         // received frame, for dropping the
+    ticks_t lastTime;                                         // copies the other slicers decode
+#endif
+    Afsk *modem;
+    LLPAddress *address;
+    uint16_t crc_out;
+    llp_callback_t hook;
     bool ready_for_data;
     uint8_t interleaveCounter;                      // Keeps track of when we have received an entire interleaved block
     uint8_t interleaveOut[LLP_INTERLEAVE_SIZE];     // A buffer for interleaving bytes before they are sent
-    uint8_t interleaveIn[LLP_INTERLEAVE_SIZE];      // A buffer for storing interleaved bytes before they are deinterleaved
 } LLPCtx;
 
-void llp_broadcast(LLPCtx *ctx, const void *_buf, size_t len);
-void llp_send(LLPCtx *ctx, LLPAddress *dst, const void *_buf, size_t len);
-void llp_sendRaw(LLPCtx *ctx, const void *_buf, size_t len);
+size_t llp_broadcastStart(LLPCtx *ctx, size_t len, uint8_t *header);
+size_t llp_sendStart(LLPCtx *ctx, LLPAddress *dst, size_t len, uint8_t *header);
+void llp_sendData(LLPCtx *ctx, const uint8_t *buf, size_t len);
+void llp_sendEnd(LLPCtx *ctx);
 void llp_poll(LLPCtx *ctx);
-void llp_init(LLPCtx *ctx, LLPAddress *address, FILE *channel, llp_callback_t hook);
+const LLPMsg *llp_rxFrame(LLPCtx *ctx);
+void llp_rxRelease(LLPCtx *ctx);
+void llp_init(LLPCtx *ctx, LLPAddress *address, Afsk *modem, llp_callback_t hook);
 
 void llpInterleave(LLPCtx *ctx, uint8_t byte);
-void llpDeinterleave(LLPCtx *ctx);
-uint8_t llpParityBlock(uint8_t first, uint8_t other);
+void llpDeinterleave(uint8_t *block);
+uint8_t llp_fec_encode_pair(uint8_t first, uint8_t other);
+uint8_t llp_fec_decode_block(uint8_t *first, uint8_t *other, uint8_t parity);
+uint8_t llp_fec_decode_soft(uint8_t *data, uint8_t parity, uint8_t weakData, uint8_t weakParity);
 
 #endif
\ No newline at end of file
@@ -0,0 +1,347 @@
+// Host benchmark for the AFSK demodulator. It is
+// built and run by "make bench", and prints how
+// many of 100 frames the receive path decodes at
+// a set of noise levels and tone twists.
+//
+// There is no recorded audio, so the audio is
+// simulated. The frames are random, 100 bytes
+// long, and encoded by the firmware's own LLP
+// code. They are then modulated with the bitrate
+// and tones of one of the modem profiles, with a
+// 24 flag preamble, and white noise is added at
+// the given SNR over the whole audio band. A
+// twist makes the space tone weaker (negative) or
+// stronger (positive) than the mark tone, like a
+// radio with de-emphasis does. A roll-off passes
+// the audio and noise through a second order
+// low-pass, like the audio stages of a radio. The
+// samples go through the ADC ISR, AFSK_poll and
+// llp_poll, just like on the modem, with the
+// demodulator that config.h selects. The receiver
+// starts out at CONFIG_AFSK_BITRATE unless told
+// otherwise, so a sender with another profile is
+// only decoded if the bitrate detection finds it.
+//
+// Without arguments, the standard set of points
+// is run. A single point can be run with
+//
+//   tools/demod_bench SNR TWIST [DC PPM LEVEL SEED PROFILE FLAGS ROLLOFF RXPROFILE]
+//
+// where DC is an offset in ADC counts, PPM is the
+// bitrate error of the sender, LEVEL is the tone
+// amplitude in ADC counts (200 by default), and
+// PROFILE is the index of the sender's profile,
+// or -1 to go through all of them frame by frame.
+// By default, the sender uses the same profile
+// as the receiver. FLAGS is the length of the
+// preamble in flags, ROLLOFF the corner of the
+// low-pass in Hz, or 0 for flat audio, and
+// RXPROFILE the profile the receiver starts at.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#include "hardware/AFSK.h"
+#include "protocol/LLP.h"
+
+#define FRAMES 100
+#define FRAME_LEN 100
+#define PREAMBLE_FLAGS 24
+static int preambleFlags = PREAMBLE_FLAGS;
+#define TRAILER_FLAGS 3
+
+volatile uint8_t PORTB, DDRB, PORTC, DDRC, PORTD, DDRD;
+volatile uint8_t TCCR1A, TCCR1B, TIFR1;
+volatile uint8_t ADMUX, ADCSRA, ADCSRB, DIDR0;
+volatile uint16_t ICR1, ADC;
+
+unsigned long custom_preamble = 300;
+unsigned long custom_tail = 30;
+
+void ADC_vect(void);
+
+static Afsk modem;
+static LLPCtx llp;
+static LLPAddress address = { 0xFFFF, 0xFFFF };
+
+static uint8_t payload[FRAMES][FRAME_LEN];
+static uint8_t stream[FRAMES][2 * LLP_MAX_FRAME_LENGTH];
+static size_t streamLen[FRAMES];
+static bool received[FRAMES];
+static int decoded, bad, dup;
+
+// Moves whatever the LLP encoder has written to
+// the modem TX FIFO into the stream of a frame
+static void drain(Afsk *sink, int frame) {
+    while (!fifo_isempty(&sink->txFifo)) {
+        stream[frame][streamLen[frame]++] = fifo_pop(&sink->txFifo);
+    }
+}
+
+static void encodeFrames(void) {
+    static Afsk sink;
+    static LLPCtx ctx;
+    AFSK_init(&sink);
+    llp_init(&ctx, &address, &sink, NULL);
+
+    srand(1);
+    for (int f = 0; f < FRAMES; f++) {
+        for (int i = 0; i < FRAME_LEN; i++) payload[f][i] = rand();
+        payload[f][0] = f;
+        payload[f][1] = f >> 8;
+
+        uint8_t header[LLP_MAX_HEADER_LENGTH];
+        size_t headerLen = llp_broadcastStart(&ctx, FRAME_LEN, header);
+        drain(&sink, f);
+        for (size_t i = 0; i < headerLen; i += LLP_SEND_CHUNK) {
+            llp_sendData(&ctx, &header[i], headerLen - i < LLP_SEND_CHUNK ? headerLen - i : LLP_SEND_CHUNK);
+            drain(&sink, f);
+        }
+        for (size_t i = 0; i < FRAME_LEN; i += LLP_SEND_CHUNK) {
+            llp_sendData(&ctx, &payload[f][i], FRAME_LEN - i < LLP_SEND_CHUNK ? FRAME_LEN - i : LLP_SEND_CHUNK);
+            drain(&sink, f);
+        }
+        llp_sendEnd(&ctx);
+        drain(&sink, f);
+    }
+    AFSK_DAC_IRQ_STOP();
+}
+
+static void frameReceived(LLPCtx *ctx, const LLPMsg *unused) {
+    const LLPMsg *msg;
+    while ((msg = llp_rxFrame(ctx)) != NULL) {
+        int f = msg->data[0] | (msg->data[1] << 8);
+        if (f < FRAMES && msg->len == FRAME_LEN && !memcmp(msg->data, payload[f], FRAME_LEN)) {
+            if (received[f]) {
+                dup++;
+            } else {
+                received[f] = true;
+                decoded++;
+            }
+        } else {
+            bad++;
+        }
+        llp_rxRelease(ctx);
+    }
+}
+
+// The simulated sender and channel
+static double phase, now, nextSample, bitTime;
+static double markFreq, spaceFreq;
+static double level, twistGain, noise, dcOffset;
+static double lpB0, lpA1, lpA2, lpX1, lpX2, lpY1, lpY2;  // Roll-off, with lpB0 zero for none
+static bool space;
+static bool stuffing;
+static int ones;
+
+static double gauss(void) {
+    double u = (rand() + 1.0) / (RAND_MAX + 2.0);
+    double v = (rand() + 1.0) / (RAND_MAX + 2.0);
+    return sqrt(-2 * log(u)) * cos(2 * M_PI * v);
+}
+
+static void sample(double audio) {
+    double x = audio + noise * gauss();
+    if (lpB0 != 0) {
+        double y = lpB0 * (x + 2 * lpX1 + lpX2) - lpA1 * lpY1 - lpA2 * lpY2;
+        lpX2 = lpX1; lpX1 = x;
+        lpY2 = lpY1; lpY1 = y;
+        x = y;
+    }
+
+    int value = (int)lrint(512 + dcOffset + x);
+    if (value < 0) value = 0;
+    if (value > 1023) value = 1023;
+    ADC = value;
+    ADC_vect();
+    AFSK_poll(&modem);
+    llp_poll(&llp);
+}
+
+static void sendBit(bool toggle) {
+    if (toggle) space = !space;
+    double freq = space ? spaceFreq : markFreq;
+    double amp = space ? level * twistGain : level;
+
+    double end = now + bitTime;
+    while (nextSample < end) {
+        phase += 2 * M_PI * freq * (nextSample - now);
+        now = nextSample;
+        sample(amp * sin(phase));
+        nextSample += 1.0 / SAMPLERATE;
+    }
+    phase += 2 * M_PI * freq * (end - now);
+    now = end;
+}
+
+// Sends a byte LSB first in NRZI, with bit
+// stuffing unless it is a flag
+static void sendByte(uint8_t b, bool stuff) {
+    if (!stuff) {
+        stuffing = false;
+    } else if (!stuffing) {
+        ones = 0;
+        stuffing = true;
+    }
+
+    for (int i = 0; i < 8; i++) {
+        if (stuffing && ones >= 5) {
+            ones = 0;
+            sendBit(true);
+        }
+        if (b & 1) {
+            ones++;
+            sendBit(false);
+        } else {
+            ones = 0;
+            sendBit(true);
+        }
+        b >>= 1;
+    }
+}
+
+static void silence(double seconds) {
+    double end = now + seconds;
+    while (nextSample < end) {
+        now = nextSample;
+        sample(0);
+        nextSample += 1.0 / SAMPLERATE;
+    }
+    now = end;
+}
+
+// Sets up the sender for a profile. The tones are
+// the ones the profile's phase increments give.
+static void senderProfile(int profile, double ppm) {
+    const AfskProfile *p = &afskProfiles[profile];
+    markFreq = (double)p->markInc * SAMPLERATE / 65536;
+    spaceFreq = (double)p->spaceInc * SAMPLERATE / 65536;
+    bitTime = 1.0 / (p->bitrate * (1 + ppm * 1e-6));
+}
+
+static int defaultProfile(void) {
+    for (int i = 0; i < AFSK_PROFILES; i++) {
+        if (afskProfiles[i].bitrate == CONFIG_AFSK_BITRATE) return i;
+    }
+    return 0;
+}
+
+// Second order Butterworth low-pass, the same as
+// the channel in tools/loopback_test.c
+static void rolloff(double corner) {
+    lpB0 = lpA1 = lpA2 = lpX1 = lpX2 = lpY1 = lpY2 = 0;
+    if (corner <= 0) return;
+
+    double k = tan(M_PI * corner / SAMPLERATE);
+    double norm = 1 / (1 + M_SQRT2 * k + k * k);
+    lpB0 = k * k * norm;
+    lpA1 = 2 * (k * k - 1) * norm;
+    lpA2 = (1 - M_SQRT2 * k + k * k) * norm;
+}
+
+static void run(double snr, double twist, double dc, double ppm, double amp, int seed, int profile,
+                double corner, int rxProfile) {
+    srand(seed);
+    AFSK_init(&modem);
+    AFSK_setProfile(&modem, rxProfile);
+    llp_init(&llp, &address, &modem, frameReceived);
+    _clock = 0;
+
+    memset(received, 0, sizeof(received));
+    decoded = bad = dup = 0;
+    phase = now = nextSample = 0;
+    space = stuffing = false;
+    ones = 0;
+
+    level = amp;
+    dcOffset = dc;
+    twistGain = pow(10, twist / 20);
+    noise = amp / sqrt(2) / pow(10, snr / 20);
+    rolloff(corner);
+
+    for (int f = 0; f < FRAMES; f++) {
+        senderProfile(profile < 0 ? f % AFSK_PROFILES : profile, ppm);
+        silence(0.05 + 0.01 * (rand() % 5));
+        for (int i = 0; i < preambleFlags; i++) sendByte(HDLC_FLAG, false);
+
+        // The stream is what the modem would get in
+        // its TX FIFO, where LLP_ESC marks a byte
+        // that is sent as data even if it looks
+        // like a flag
+        for (size_t i = 0; i < streamLen[f]; i++) {
+            uint8_t c = stream[f][i];
+            if (c == LLP_ESC) {
+                sendByte(stream[f][++i], true);
+            } else {
+                sendByte(c, c != HDLC_FLAG && c != HDLC_RESET);
+            }
+        }
+        for (int i = 0; i < TRAILER_FLAGS; i++) sendByte(HDLC_FLAG, false);
+    }
+    silence(0.2);
+
+    printf("snr %g twist %g", snr, twist);
+    if (profile < 0) {
+        printf(" at mixed bitrates");
+    } else if (profile != defaultProfile()) {
+        printf(" at %u bps", afskProfiles[profile].bitrate);
+    }
+    if (corner > 0) printf(" rolloff %g Hz", corner);
+    if (rxProfile != defaultProfile()) printf(" receiver at %u bps", afskProfiles[rxProfile].bitrate);
+    printf(": decoded %d/%d bad %d dup %d\n", decoded, FRAMES, bad, dup);
+}
+
+int main(int argc, char **argv) {
+    static const double points[][2] = {
+        { 30, 0 }, { 10, 0 }, { 8, 0 }, { 6, 0 },
+        { 12, -9 }, { 12, -6 }, { 9, -6 }, { 12, -3 }, { 9, -3 },
+        { 9, 3 }, { 9, 6 }, { 9, 9 }, { 6, 6 }, { 6, -6 },
+    };
+
+    // Senders at the other bitrates, and a channel
+    // where every frame comes at the next bitrate,
+    // which the receiver must detect by itself.
+    // Profile -1 is the mixed channel.
+    static const double mixedPoints[][2] = {
+        { 30, 0 }, { 12, 0 }, { 30, 2 }, { 12, 2 }, { 30, -1 }, { 15, -1 },
+    };
+
+    // Each bitrate through a radio that rolls off
+    // the audio at 4 kHz and at 3 kHz, with the
+    // receiver set to the sender's profile, so the
+    // filters are measured and not the detection
+    static const double rolloffPoints[][2] = {
+        { 20, 4000 }, { 15, 4000 }, { 12, 4000 }, { 10, 4000 }, { 8, 4000 }, { 6, 4000 },
+        { 20, 3000 }, { 15, 3000 }, { 12, 3000 }, { 10, 3000 }, { 8, 3000 }, { 6, 3000 },
+    };
+
+    encodeFrames();
+
+    if (argc >= 3) {
+        if (argc > 8) preambleFlags = atoi(argv[8]);
+        run(atof(argv[1]), atof(argv[2]),
+            argc > 3 ? atof(argv[3]) : 0,
+            argc > 4 ? atof(argv[4]) : 0,
+            argc > 5 ? atof(argv[5]) : 200,
+            argc > 6 ? atoi(argv[6]) : 1,
+            argc > 7 ? atoi(argv[7]) : defaultProfile(),
+            argc > 9 ? atof(argv[9]) : 0,
+            argc > 10 ? atoi(argv[10]) : defaultProfile());
+    } else {
+        for (size_t i = 0; i < sizeof(points) / sizeof(points[0]); i++) {
+            run(points[i][0], points[i][1], 0, 0, 200, 1, defaultProfile(), 0, defaultProfile());
+        }
+        for (size_t i = 0; i < sizeof(mixedPoints) / sizeof(mixedPoints[0]); i++) {
+            run(mixedPoints[i][0], 0, 0, 0, 200, 1, (int)mixedPoints[i][1], 0, defaultProfile());
+        }
+        for (int profile = 0; profile < AFSK_PROFILES; profile++) {
+            for (size_t i = 0; i < sizeof(rolloffPoints) / sizeof(rolloffPoints[0]); i++) {
+                run(rolloffPoints[i][0], 0, 0, 0, 200, 1, profile, rolloffPoints[i][1], profile);
+            }
+        }
+    }
+
+    return 0;
+}
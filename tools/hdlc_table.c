@@ -0,0 +1,86 @@
+// Host tool that generates the lookup table for
+// the byte-at-a-time HDLC deframer. It is built
+// and run by the Makefile, and the output is
+// written to protocol/HDLC-table.c
+//
+// Every entry describes what happens when the
+// deframer is in a given state (the number of
+// consecutive ones received so far) and receives
+// the next 8 demodulated bits, earliest bit in
+// the LSB. This must match hdlcParseBit() in
+// hardware/AFSK.c exactly, which tools/hdlc_test.c
+// checks.
+//
+// The states and events come from protocol/HDLC.h,
+// which is built with the avr-libc stand-ins in
+// tools/host.
+
+#include <stdio.h>
+#include <stdint.h>
+
+#include "protocol/HDLC.h"
+
+int main(void) {
+    printf("// This file is generated by tools/hdlc_table.c, do not edit!\n\n");
+    printf("#include \"protocol/HDLC.h\"\n\n");
+    printf("const HdlcRxEntry hdlc_rx_table[HDLC_RX_STATES][256] PROGMEM = {\n");
+
+    for (int state = 0; state < HDLC_RX_STATES; state++) {
+        printf("    {\n");
+        for (int byte = 0; byte < 256; byte++) {
+            uint8_t ones = state;
+            uint8_t bits = 0;
+            uint8_t count = 0;
+            uint8_t event = HDLC_EVENT_NONE;
+            uint8_t split = 0;
+            uint8_t keep = 0;
+
+            for (int i = 0; i < 8; i++) {
+                int bit = (byte >> i) & 0x01;
+                int found = HDLC_EVENT_NONE;
+
+                if (bit) {
+                    if (ones == 6) {
+                        // Seven ones in a row is an abort
+                        found = HDLC_EVENT_ABORT;
+                        ones = 7;
+                    } else if (ones < 6) {
+                        bits |= 1 << count;
+                        keep |= 1 << i;
+                        count++;
+                        ones++;
+                    }
+                } else {
+                    if (ones == 6) {
+                        // A zero after exactly six ones is a flag
+                        found = HDLC_EVENT_FLAG;
+                    } else if (ones < 5) {
+                        keep |= 1 << i;
+                        count++;
+                    }
+                    // A zero after five ones is a stuffed
+                    // bit, and a zero after an abort just
+                    // ends it, so neither carry data
+                    ones = 0;
+                }
+
+                if (found != HDLC_EVENT_NONE) {
+                    if (event == HDLC_EVENT_NONE) {
+                        event = found;
+                        split = count;
+                    } else {
+                        event = HDLC_EVENT_MULTI;
+                    }
+                }
+            }
+
+            uint8_t ctrl = ones | (event << 3) | (split << 5);
+            printf("%s{0x%02x,%u,0x%02x,0x%02x},", (byte % 8 == 0) ? "        " : " ", bits, count, ctrl, keep);
+            if (byte % 8 == 7) printf("\n");
+        }
+        printf("    },\n");
+    }
+
+    printf("};\n");
+    return 0;
+}
@@ -0,0 +1,178 @@
+// Host test for the HDLC deframer. It is built
+// and run by the Makefile, and fails the build if
+// the byte at a time deframer in hardware/AFSK.c,
+// which uses the generated hdlc_rx_table, doesn't
+// do exactly the same as feeding the same bits to
+// hdlcParseBit one at a time, which is how the
+// deframing is defined.
+//
+// Both deframers get the same streams, 8 bits at
+// a time, and after every byte their state and
+// everything they have written to the receive
+// FIFO must be the same. The streams are random
+// bits, with and without weak bits, and real bit
+// stuffed frames with flags and aborts between
+// them, starting at every bit offset, so flags
+// and stuffed bits end up at every position in
+// the bytes the deframer sees.
+//
+// The deframer functions are static, so the test
+// includes hardware/AFSK.c itself, and is built
+// with the avr-libc stand-ins in tools/host.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "hardware/AFSK.c"
+
+#define ROUNDS 2000
+#define STREAM_BITS 4096
+
+volatile uint8_t PORTB, DDRB, PORTC, DDRC, PORTD, DDRD;
+volatile uint8_t TCCR1A, TCCR1B, TIFR1;
+volatile uint8_t ADMUX, ADCSRA, ADCSRB, DIDR0;
+volatile uint16_t ICR1, ADC;
+
+unsigned long custom_preamble = 300;
+unsigned long custom_tail = 30;
+
+static uint8_t bits[STREAM_BITS / 8], weak[STREAM_BITS / 8];
+static size_t bitCount;
+
+typedef struct Deframer {
+    Hdlc hdlc;
+    FIFOBuffer fifo;
+    uint8_t buf[16];
+    uint8_t out[4 * STREAM_BITS / 8];
+    size_t outLen;
+    bool ret;
+} Deframer;
+
+static void putBit(bool bit, bool isWeak) {
+    if (bitCount >= STREAM_BITS) return;
+    if (bit) bits[bitCount / 8] |= 1 << (bitCount % 8);
+    if (isWeak) weak[bitCount / 8] |= 1 << (bitCount % 8);
+    bitCount++;
+}
+
+// Puts a byte in the stream LSB first, with a
+// zero stuffed in after five ones unless it is a
+// flag or an abort
+static int ones;
+static void putByte(uint8_t byte, bool stuff, uint8_t weakMask) {
+    for (int i = 0; i < 8; i++) {
+        bool bit = (byte >> i) & 0x01;
+        putBit(bit, (weakMask >> i) & 0x01);
+        ones = bit ? ones + 1 : 0;
+        if (stuff && ones == 5) {
+            putBit(false, false);
+            ones = 0;
+        }
+    }
+    if (!stuff) ones = 0;
+}
+
+static void randomStream(bool withWeak) {
+    for (size_t i = 0; i < sizeof(bits); i++) {
+        bits[i] = rand();
+        weak[i] = withWeak && rand() % 4 == 0 ? rand() & rand() : 0;
+    }
+    bitCount = STREAM_BITS;
+}
+
+// Frames of random length, mostly with data that
+// has long runs of ones, so there are plenty of
+// stuffed bits and data bytes that look like
+// flags. Some end in an abort instead of a flag.
+static void frameStream(int offset, bool withWeak) {
+    memset(bits, 0, sizeof(bits));
+    memset(weak, 0, sizeof(weak));
+    bitCount = 0;
+    ones = 0;
+
+    for (int i = 0; i < offset; i++) putBit(rand() & 1, false);
+    while (bitCount < STREAM_BITS) {
+        int flags = 1 + rand() % 3;
+        for (int i = 0; i < flags; i++) putByte(HDLC_FLAG, false, 0);
+
+        int len = rand() % 40;
+        for (int i = 0; i < len; i++) {
+            uint8_t byte;
+            switch (rand() % 4) {
+                case 0:  byte = rand(); break;
+                case 1:  byte = HDLC_FLAG; break;
+                case 2:  byte = 0xFF; break;
+                default: byte = rand() | rand(); break;
+            }
+            putByte(byte, true, withWeak && rand() % 3 == 0 ? rand() : 0);
+        }
+
+        if (rand() % 5 == 0) {
+            putByte(HDLC_RESET, false, 0);
+            putByte(0xFF, false, 0);
+        }
+    }
+}
+
+static void drain(Deframer *d) {
+    while (!fifo_isempty(&d->fifo)) d->out[d->outLen++] = fifo_pop(&d->fifo);
+}
+
+static void reset(Deframer *d) {
+    memset(&d->hdlc, 0, sizeof(d->hdlc));
+    fifo_init(&d->fifo, d->buf, sizeof(d->buf));
+    d->outLen = 0;
+}
+
+static bool sameState(const Hdlc *a, const Hdlc *b) {
+    return a->ones == b->ones && a->bitIndex == b->bitIndex &&
+           a->currentByte == b->currentByte && a->currentWeak == b->currentWeak &&
+           a->receiving == b->receiving && a->dcd == b->dcd && a->dcd_count == b->dcd_count;
+}
+
+static int check(const char *what, int round) {
+    static Deframer table, reference;
+    reset(&table);
+    reset(&reference);
+
+    for (size_t i = 0; i < bitCount / 8; i++) {
+        table.ret = hdlcParse(&table.hdlc, bits[i], weak[i], &table.fifo);
+
+        reference.ret = true;
+        for (int b = 0; b < 8; b++) {
+            if (!hdlcParseBit(&reference.hdlc, (bits[i] >> b) & 0x01, (weak[i] >> b) & 0x01, &reference.fifo)) {
+                reference.ret = false;
+            }
+        }
+
+        drain(&table);
+        drain(&reference);
+        if (table.ret != reference.ret || !sameState(&table.hdlc, &reference.hdlc) ||
+            table.outLen != reference.outLen || memcmp(table.out, reference.out, table.outLen)) {
+            fprintf(stderr, "hdlc_test: %s, round %d, byte %zu (%02X weak %02X) decodes differently\n",
+                    what, round, i, bits[i], weak[i]);
+            return 1;
+        }
+    }
+
+    return 0;
+}
+
+int main(void) {
+    srand(1);
+
+    for (int round = 0; round < ROUNDS; round++) {
+        randomStream(false);
+        if (check("random bits", round)) return 1;
+        randomStream(true);
+        if (check("random bits with weak bits", round)) return 1;
+
+        frameStream(round % 8, false);
+        if (check("stuffed frames", round)) return 1;
+        frameStream(round % 8, true);
+        if (check("stuffed frames with weak bits", round)) return 1;
+    }
+
+    return 0;
+}
@@ -0,0 +1,11 @@
+// On the host, an ISR is an ordinary function
+// that the benchmark calls for every sample.
+
+#ifndef HOST_AVR_INTERRUPT_H
+#define HOST_AVR_INTERRUPT_H
+
+#define ISR(vector) void vector(void)
+#define sei()
+#define cli()
+
+#endif
@@ -0,0 +1,33 @@
+// Just enough of <avr/io.h> to build the modem
+// code on the host, for the benchmark in
+// tools/demod_bench.c and the host tests that use
+// the modem code. The registers are plain
+// variables, defined by each of those programs.
+
+#ifndef HOST_AVR_IO_H
+#define HOST_AVR_IO_H
+
+#include <stdint.h>
+
+#define _BV(bit) (1 << (bit))
+
+extern volatile uint8_t PORTB, DDRB, PORTC, DDRC, PORTD, DDRD;
+extern volatile uint8_t TCCR1A, TCCR1B, TIFR1;
+extern volatile uint8_t ADMUX, ADCSRA, ADCSRB, DIDR0;
+extern volatile uint16_t ICR1, ADC;
+
+#define CS10  0
+#define WGM12 3
+#define WGM13 4
+#define ICF1  5
+#define REFS0 6
+#define ADTS0 0
+#define ADTS1 1
+#define ADTS2 2
+#define ADPS2 2
+#define ADIE  3
+#define ADATE 5
+#define ADSC  6
+#define ADEN  7
+
+#endif
@@ -0,0 +1,15 @@
+// The host has no separate program memory, so
+// these just read normal memory.
+
+#ifndef HOST_AVR_PGMSPACE_H
+#define HOST_AVR_PGMSPACE_H
+
+#include <stdint.h>
+#include <string.h>
+
+#define PROGMEM
+#define pgm_read_byte(p) (*(const uint8_t *)(p))
+#define pgm_read_word(p) (*(const uint16_t *)(p))
+#define memcpy_P(dst, src, n) memcpy((dst), (src), (n))
+
+#endif
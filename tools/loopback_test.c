@@ -0,0 +1,372 @@
+// Host test for the whole modem, from the LLP
+// encoder to the LLP decoder. It is built and run
+// by the Makefile, and fails the build if frames
+// sent by one modem don't come out of another.
+//
+// The sending modem encodes random frames with
+// llp_sendStart, llp_sendData and llp_sendEnd,
+// and AFSK_poll and AFSK_dac_isr turn them into
+// DAC samples, just like on the modem. The DAC
+// output goes through a simulated radio channel,
+// which has a low-pass filter of a given width,
+// white noise at a given SNR, can run the
+// sender's clock off by a number of ppm, and can
+// invert the signal. It can also de-emphasise
+// the audio, like a radio that expects
+// pre-emphasis, which makes the space tone
+// weaker than the mark tone. What comes out is
+// fed to the ADC ISR, AFSK_poll and llp_poll of
+// the receiving modem.
+//
+// Every point must decode at least the given
+// number of frames, with no bad or duplicated
+// frames at all. One more run starves the
+// encoder of the sending modem in the middle of
+// a frame. That frame must be aborted and
+// counted, and none of it may reach the receiver,
+// while all the other frames still get through.
+//
+// The Makefile also builds it with three slicers,
+// as tools/loopback_slicers_test, which must pass
+// the same points, and for G3RUH, whatever
+// config.h selects, as tools/g3ruh_loopback_test.
+// The G3RUH points run the raised cosine DAC
+// shapes, the 1-2-1 receive filter, the clock
+// recovery and the descrambler of the modem.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#include "hardware/AFSK.h"
+#include "protocol/LLP.h"
+
+#define FRAMES 50
+#define FRAME_LEN 100
+#define STARVED_FRAME 20
+
+volatile uint8_t PORTB, DDRB, PORTC, DDRC, PORTD, DDRD;
+volatile uint8_t TCCR1A, TCCR1B, TIFR1;
+volatile uint8_t ADMUX, ADCSRA, ADCSRB, DIDR0;
+volatile uint16_t ICR1, ADC;
+
+unsigned long custom_preamble = 300;
+unsigned long custom_tail = 30;
+
+extern bool hw_afsk_dac_isr;
+void ADC_vect(void);
+uint8_t AFSK_dac_isr(Afsk *afsk);
+
+typedef struct Point {
+    double snr;                             // Signal to noise ratio in dB, 0 for none
+    double ppm;                             // Clock error of the sender
+    bool invert;                            // Whether the channel inverts the signal
+    bool deemphasis;                        // Whether the channel tilts the audio by 6 dB per octave
+    double width;                           // Width of the channel in Hz, 0 for CHANNEL_WIDTH
+    unsigned bitrate;                       // Bitrate of both modems, 0 for the default one
+    int minDecoded;                         // Frames that must get through
+} Point;
+
+// The channel is as wide as the radio would let
+// through for the modulation. The noise is white
+// over the whole sample rate, and the SNR is
+// given against the signal through a channel of
+// CHANNEL_WIDTH at the default bitrate.
+#if MODULATION == MODULATION_G3RUH
+    #define CHANNEL_WIDTH 6000.0
+    static const Point points[] = {
+        { 0, 0, false, false, 0, 0, FRAMES },
+        { 15, 0, false, false, 0, 0, FRAMES },
+        { 13, 0, false, false, 0, 0, FRAMES },
+        { 12, 0, false, false, 0, 0, FRAMES },
+        { 11, 0, false, false, 0, 0, FRAMES },
+        { 8, 0, false, false, 0, 0, 42 },
+        { 15, 0, false, false, 4800, 0, FRAMES },
+        { 12, 0, true, false, 0, 0, FRAMES },
+        { 12, 200, false, false, 0, 0, FRAMES },
+        { 12, 5000, false, false, 0, 0, FRAMES },
+        { 12, -8000, true, false, 0, 0, FRAMES },
+        { 12, 0, false, false, 3000, 4800, FRAMES },
+        { 5, 0, false, false, 3000, 4800, 28 },
+    };
+#else
+    #define CHANNEL_WIDTH 3000.0
+
+    // With de-emphasis, the offset slicers decode
+    // frames the centred one loses, and the centred
+    // one alone loses most of them at 6 dB
+    #if CONFIG_AFSK_SLICERS > 1
+        #define DEEMPHASIS_10 FRAMES
+        #define DEEMPHASIS_8 46
+    #else
+        #define DEEMPHASIS_10 47
+        #define DEEMPHASIS_8 33
+    #endif
+
+    static const Point points[] = {
+        { 0, 0, false, false, 0, 0, FRAMES },
+        { 10, 0, false, false, 0, 0, FRAMES },
+        { 6, 0, false, false, 0, 0, 45 },
+        { 6, 200, false, false, 0, 0, 38 },
+        { 6, -200, true, false, 0, 0, 38 },
+        { 0, 0, false, true, 0, 0, FRAMES },
+        { 10, 0, false, true, 0, 0, DEEMPHASIS_10 },
+        { 8, 0, false, true, 0, 0, DEEMPHASIS_8 },
+    #if CONFIG_AFSK_SLICERS > 1
+        { 6, 0, false, true, 0, 0, 43 },
+    #endif
+    };
+#endif
+
+#define LEVEL 1.5                           // ADC counts per DAC step
+#define CHANNEL_OVERSAMPLE 8                // Channel samples per receiver sample
+#define DEEMPHASIS_CORNER 300.0
+#define DEEMPHASIS_CENTRE 1700.0
+
+static Afsk sender, receiver;
+static LLPCtx senderLlp, receiverLlp;
+static LLPAddress address = { 0xFFFF, 0xFFFF };
+
+static uint8_t payload[FRAMES][FRAME_LEN];
+static bool received[FRAMES];
+static int decoded, bad, dup;
+static long afterStall;                     // Samples sent after the encoder was starved
+
+static void frameReceived(LLPCtx *ctx, const LLPMsg *unused) {
+    const LLPMsg *msg;
+    while ((msg = llp_rxFrame(ctx)) != NULL) {
+        int f = msg->data[0];
+        if (f < FRAMES && msg->len == FRAME_LEN && !memcmp(msg->data, payload[f], FRAME_LEN)) {
+            if (received[f]) {
+                dup++;
+            } else {
+                received[f] = true;
+                decoded++;
+            }
+        } else {
+            bad++;
+        }
+        llp_rxRelease(ctx);
+    }
+}
+
+// The sender goes through each frame a piece at
+// a time, whenever its TX FIFO has room, and
+// waits for the transmission to end and a gap
+// of silence before the next one
+static int frame, part;
+static size_t pos, headerLen;
+static uint8_t header[LLP_MAX_HEADER_LENGTH];
+static long gap;
+
+static void feedSender(void) {
+    if (frame >= FRAMES) return;
+    if (part == 0) {
+        if (sender.sending || --gap > 0) return;
+        pos = 0;
+        part = 1;
+    }
+    if (fifo_space(&sender.txFifo) < LLP_SEND_CHUNK_SPACE) return;
+
+    if (part == 1) {
+        headerLen = llp_broadcastStart(&senderLlp, FRAME_LEN, header);
+        part = 2;
+    } else if (part == 2) {
+        size_t n = headerLen - pos < LLP_SEND_CHUNK ? headerLen - pos : LLP_SEND_CHUNK;
+        llp_sendData(&senderLlp, &header[pos], n);
+        pos += n;
+        if (pos == headerLen) {
+            pos = 0;
+            part = 3;
+        }
+    } else if (part == 3) {
+        size_t n = FRAME_LEN - pos < LLP_SEND_CHUNK ? FRAME_LEN - pos : LLP_SEND_CHUNK;
+        llp_sendData(&senderLlp, &payload[frame][pos], n);
+        pos += n;
+        if (pos == FRAME_LEN) part = 4;
+    } else {
+        llp_sendEnd(&senderLlp);
+        frame++;
+        part = 0;
+        gap = SAMPLERATE / 20 + rand() % (SAMPLERATE / 20);
+    }
+}
+
+static double gauss(void) {
+    double u = (rand() + 1.0) / (RAND_MAX + 2.0);
+    double v = (rand() + 1.0) / (RAND_MAX + 2.0);
+    return sqrt(-2 * log(u)) * cos(2 * M_PI * v);
+}
+
+// Runs a whole set of frames through the channel,
+// and returns the RMS level of the signal at the
+// receiver while the sender was sending. If stall
+// is given, the sender's main loop stops for that
+// many samples in the middle of STARVED_FRAME.
+static double run(const Point *p, double noise, long stall) {
+    AFSK_init(&sender);
+    llp_init(&senderLlp, &address, &sender, NULL);
+    AFSK_init(&receiver);
+    llp_init(&receiverLlp, &address, &receiver, frameReceived);
+    _clock = 0;
+
+    memset(received, 0, sizeof(received));
+    decoded = bad = dup = 0;
+    afterStall = 0;
+    frame = part = 0;
+    gap = SAMPLERATE / 10;
+
+    if (p->bitrate) {
+        for (uint8_t i = 0; i < AFSK_PROFILES; i++) {
+            if (AFSK_profileBitrate(i) == p->bitrate) {
+                AFSK_setProfile(&sender, i);
+                AFSK_setProfile(&receiver, i);
+            }
+        }
+    }
+
+    // Second order Butterworth low-pass filter,
+    // run at the channel's own rate
+    double k = tan(M_PI * (p->width ? p->width : CHANNEL_WIDTH) / (SAMPLERATE * CHANNEL_OVERSAMPLE));
+    double norm = 1 / (1 + M_SQRT2 * k + k * k);
+    double b0 = k * k * norm;
+    double a1 = 2 * (k * k - 1) * norm;
+    double a2 = (1 - M_SQRT2 * k + k * k) * norm;
+    double x1 = 0, x2 = 0, y1 = 0, y2 = 0;
+
+    // First order de-emphasis, with its corner far
+    // enough below the tones that it falls by 6 dB
+    // per octave across them, and scaled to keep
+    // the level between the tones
+    double emphasis = 1 - exp(-2 * M_PI * DEEMPHASIS_CORNER / (SAMPLERATE * CHANNEL_OVERSAMPLE));
+    double emphasisGain = hypot(1, DEEMPHASIS_CENTRE / DEEMPHASIS_CORNER);
+    double z = 0;
+
+    double senderTime = 0, senderPeriod = 1 / (1 + p->ppm * 1e-6);
+    double dac = 0, power = 0;
+    long powerCount = 0, stalled = 0;
+    bool stallDone = false;
+
+    while (frame < FRAMES || sender.sending) {
+        // The channel runs faster than the modems, so
+        // a sender on another clock changes its DAC
+        // output between the receiver's samples, and
+        // the bit timing drifts smoothly instead of
+        // jumping by a whole sample now and then
+        double y = 0;
+        for (int i = 0; i < CHANNEL_OVERSAMPLE; i++) {
+            // The sender runs on its own clock
+            while (senderTime <= 0) {
+                feedSender();
+                if (stall && frame == STARVED_FRAME && part == 3 && pos > FRAME_LEN / 2 && stalled < stall) {
+                    stalled++;
+                } else {
+                    AFSK_poll(&sender);
+                }
+                dac = hw_afsk_dac_isr ? (double)((AFSK_dac_isr(&sender) & 0xF0) | _BV(3)) - 128 : 0;
+                senderTime += senderPeriod;
+                if (stall && stalled == stall && !stallDone) {
+                    if (sender.sending) {
+                        afterStall++;
+                    } else {
+                        stallDone = true;
+                    }
+                }
+            }
+            senderTime -= 1.0 / CHANNEL_OVERSAMPLE;
+
+            double x = dac * LEVEL;
+            y = b0 * (x + 2 * x1 + x2) - a1 * y1 - a2 * y2;
+            x2 = x1; x1 = x;
+            y2 = y1; y1 = y;
+            if (p->deemphasis) {
+                z += emphasis * (y - z);
+                y = z * emphasisGain;
+            }
+        }
+
+        if (sender.sending) {
+            power += y * y;
+            powerCount++;
+        }
+
+        double audio = (p->invert ? -y : y) + noise * gauss();
+        int value = (int)lrint(512 + audio);
+        if (value < 0) value = 0;
+        if (value > 1023) value = 1023;
+
+        // The ISR would also run the receiver's DAC,
+        // which has nothing to send
+        bool dacIsr = hw_afsk_dac_isr;
+        hw_afsk_dac_isr = false;
+        ADC = value;
+        ADC_vect();
+        hw_afsk_dac_isr = dacIsr;
+
+        AFSK_poll(&receiver);
+        llp_poll(&receiverLlp);
+    }
+
+    for (long i = 0; i < SAMPLERATE / 5; i++) {
+        ADC = 512 + (int)lrint(noise * gauss());
+        ADC_vect();
+        AFSK_poll(&receiver);
+        llp_poll(&receiverLlp);
+    }
+
+    return sqrt(power / powerCount);
+}
+
+int main(void) {
+    srand(1);
+    for (int f = 0; f < FRAMES; f++) {
+        for (int i = 0; i < FRAME_LEN; i++) payload[f][i] = rand();
+        payload[f][0] = f;
+    }
+
+    int failed = 0;
+    double level = 0;
+    for (size_t i = 0; i < sizeof(points) / sizeof(points[0]); i++) {
+        const Point *p = &points[i];
+        if (level == 0) level = run(p, 0, 0);
+
+        srand(i + 1);
+        double noise = p->snr ? level / pow(10, p->snr / 20) : 0;
+        run(p, noise, 0);
+        if (decoded < p->minDecoded || bad || dup) {
+            fprintf(stderr, "loopback_test: snr %g ppm %g%s%s", p->snr, p->ppm,
+                    p->invert ? " inverted" : "", p->deemphasis ? " de-emphasised" : "");
+            if (p->width) fprintf(stderr, " in %g Hz", p->width);
+            if (p->bitrate) fprintf(stderr, " at %u bps", p->bitrate);
+            fprintf(stderr, ": decoded %d/%d bad %d dup %d\n", decoded, FRAMES, bad, dup);
+            failed = 1;
+        }
+    }
+
+    // The encoder is starved for twice as long as
+    // it takes the ISR to run out of bits. After
+    // that, only the end of the abort, the closing
+    // flag and the tail may still be sent, and not
+    // the rest of the frame. The tail can be sent
+    // twice, since the encoder starts on it when
+    // it has dropped everything in the TX FIFO,
+    // and starts over when more data comes in.
+    const Point clean = { 0, 0, false, false, 0, 0, FRAMES - 1 };
+    uint8_t samplesPerBit = sender.profile.samplesPerBit;
+    long stall = 2 * 8 * CONFIG_AFSK_TXBITS_BUFLEN * samplesPerBit;
+    long tailBits = DIV_ROUND(custom_tail * sender.profile.bitrate, 1000);
+    long maxAfterStall = (8 * (CONFIG_AFSK_ABORT_LEN + 2) + 2 * tailBits + 128) * samplesPerBit;
+
+    run(&clean, 0, stall);
+    if (received[STARVED_FRAME] || decoded != FRAMES - 1 || bad || dup || sender.txUnderruns != 1 ||
+        afterStall > maxAfterStall) {
+        fprintf(stderr, "loopback_test: starved encoder: decoded %d/%d%s bad %d dup %d underruns %u, "
+                "sent for %ld samples after the stall\n",
+                decoded, FRAMES, received[STARVED_FRAME] ? " with the starved frame" : "",
+                bad, dup, sender.txUnderruns, afterStall);
+        failed = 1;
+    }
+
+    return failed;
+}
@@ -0,0 +1,267 @@
+// Host tool that generates the table of modem
+// profiles. It is built and run by the Makefile,
+// and the output is written to
+// hardware/AFSK-profiles.c
+//
+// The tool is compiled against the same device.h
+// and config.h as the firmware, so the table is
+// always made for the modulation and sample rate
+// the firmware is built with. To add a profile or
+// tune a filter, change the design tables below,
+// and AFSK_PROFILES in hardware/AFSK.h if the
+// number of profiles changes.
+//
+// For AFSK, every profile gets two filters, both
+// second-order Butterworth sections designed with
+// the bilinear transform. The band-pass filter in
+// front of the demodulator is centred between the
+// two tones, and keeps noise and other signals
+// outside them from reaching it. The low-pass
+// filter after the discriminator smooths its
+// products into a bit decision.
+//
+// The numerators of these filters are always
+// 1 2 1 for the low-pass and 1 0 -1 for the band-
+// pass, so the firmware does them with shifts and
+// adds, and only the gain and the two feedback
+// coefficients are given, with AFSK_FILTER_FRAC
+// bits of fraction. The gains are worked out from
+// the response of the filters with the feedback
+// rounded, just as the firmware will run them.
+//
+// For G3RUH, every profile gets a table of DAC
+// levels that shapes the bits, for the number of
+// samples per bit it has.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+#include "device.h"
+
+#define SAMPLERATE CONFIG_AFSK_DAC_SAMPLERATE
+
+// These must match hardware/AFSK.h
+#define AFSK_FILTER_FRAC 12
+#define AFSK_BAND_SHIFT 6
+#define AFSK_PRODUCT_SHIFT 2
+
+#if MODULATION == MODULATION_G3RUH
+typedef struct {
+    unsigned bitrate;
+    unsigned phaseBits;
+} ProfileDesign;
+
+static const ProfileDesign profiles[] = {
+    { 4800, 8 },
+    { 9600, 8 },
+};
+#else
+// The low-pass cutoffs and the widths of the
+// band-pass filters, in multiples of the tone
+// spacing, are where the most frames came through
+// on the roll-off points of tools/demod_bench.c,
+// which "make bench" runs. At 960 and 1600 bps,
+// the band-pass filter lost more frames than it
+// saved, so those profiles have none, and a width
+// of zero leaves it out.
+typedef struct {
+    unsigned bitrate;
+    unsigned phaseBits;
+    unsigned mark;
+    unsigned space;
+    unsigned lowpassCutoff;
+    double bandpassWidth;
+} ProfileDesign;
+
+static const ProfileDesign profiles[] = {
+    { 960,  10, 960,  1600, 750,  0.0 },
+    { 1200, 8,  1200, 2200, 700,  3.0 },
+    { 1600, 8,  1600, 2600, 1300, 0.0 },
+};
+#endif
+
+#define PROFILES (sizeof(profiles) / sizeof(profiles[0]))
+
+static void fail(const char *message, unsigned bitrate) {
+    fprintf(stderr, "profile_table: %s (%u bps)\n", message, bitrate);
+    exit(1);
+}
+
+#if MODULATION == MODULATION_AFSK
+typedef struct {
+    int b0, a1, a2;
+} Biquad;
+
+static int quantize(double value, unsigned bitrate) {
+    long q = lround(value * (1 << AFSK_FILTER_FRAC));
+    if (q < -32768 || q > 32767) fail("filter coefficient out of range", bitrate);
+    return (int)q;
+}
+
+// Runs the filter with the gain left at one, and
+// returns the sum of the magnitudes of its impulse
+// response. No input of that size can give an
+// output larger than this.
+static double responseSum(const Biquad *f, const int numerator[3]) {
+    double a1 = (double)f->a1 / (1 << AFSK_FILTER_FRAC);
+    double a2 = (double)f->a2 / (1 << AFSK_FILTER_FRAC);
+    double y1 = 0, y2 = 0, sum = 0;
+    for (int n = 0; n < 4096; n++) {
+        double x = (n < 3) ? numerator[n] : 0;
+        double y = x - a1 * y1 - a2 * y2;
+        sum += fabs(y);
+        y2 = y1;
+        y1 = y;
+    }
+    return sum;
+}
+
+// The gain of the filter at one frequency, again
+// with the gain coefficient left at one
+static double responseAt(const Biquad *f, const int numerator[3], double freq) {
+    double w = 2.0 * M_PI * freq / SAMPLERATE;
+    double a1 = (double)f->a1 / (1 << AFSK_FILTER_FRAC);
+    double a2 = (double)f->a2 / (1 << AFSK_FILTER_FRAC);
+    double nr = numerator[0] + numerator[1] * cos(w) + numerator[2] * cos(2 * w);
+    double ni = -numerator[1] * sin(w) - numerator[2] * sin(2 * w);
+    double dr = 1 + a1 * cos(w) + a2 * cos(2 * w);
+    double di = -a1 * sin(w) - a2 * sin(2 * w);
+    return sqrt((nr * nr + ni * ni) / (dr * dr + di * di));
+}
+
+// The low-pass filter gets its products shifted
+// right by AFSK_PRODUCT_SHIFT, and its gain is as
+// high as it can be without the output ever going
+// outside 16 bits
+static Biquad lowpass(unsigned bitrate, double cutoff) {
+    static const int numerator[3] = { 1, 2, 1 };
+    double w = 2.0 * M_PI * cutoff / SAMPLERATE;
+    double alpha = sin(w) / (2.0 * M_SQRT1_2);
+    double a0 = 1.0 + alpha;
+
+    Biquad f;
+    f.a1 = quantize(-2.0 * cos(w) / a0, bitrate);
+    f.a2 = quantize((1.0 - alpha) / a0, bitrate);
+
+    double maxInput = (128.0 * 128.0) / (1 << AFSK_PRODUCT_SHIFT);
+    double gain = 32767.0 / (maxInput * responseSum(&f, numerator));
+    f.b0 = (int)floor(gain * (1 << AFSK_FILTER_FRAC));
+    if (f.b0 < 1 || f.b0 > 32767) fail("low-pass gain out of range", bitrate);
+    return f;
+}
+
+// The band-pass filter keeps its output with
+// AFSK_BAND_SHIFT bits of fraction, and its gain
+// is one at its centre, so the demodulator sees
+// the tones at the level the AGC has set. Without
+// a width, the filter comes out with no gain,
+// which tells the firmware to skip it.
+static Biquad bandpass(unsigned bitrate, double low, double high, double width) {
+    static const int numerator[3] = { 1, 0, -1 };
+    Biquad f = { 0, 0, 0 };
+    if (width == 0.0) return f;
+
+    double centre = sqrt(low * high);
+    double w = 2.0 * M_PI * centre / SAMPLERATE;
+    double q = centre / (width * (high - low));
+    double alpha = sin(w) / (2.0 * q);
+    double a0 = 1.0 + alpha;
+
+    f.a1 = quantize(-2.0 * cos(w) / a0, bitrate);
+    f.a2 = quantize((1.0 - alpha) / a0, bitrate);
+    f.b0 = quantize(1.0 / responseAt(&f, numerator, centre), bitrate);
+    return f;
+}
+#else
+// The DAC output for each sample of a bit, for
+// every combination of the previous, current and
+// next line level, in that order from the top
+// bit of the index. A change of level follows
+// half a period of a cosine, one bit long and
+// centred on the bit boundary, so the level is
+// settled in the middle of every bit. Only the
+// top four bits reach the DAC, and the levels go
+// from 1 to 14, which sit symmetrically around
+// its middle, so the average of the signal is
+// also where the receiver should slice it.
+static void printShape(unsigned bitrate, unsigned samplesPerBit) {
+    printf("static const uint8_t g3ruhShape%u[8][%u] PROGMEM = {\n", bitrate, samplesPerBit);
+    for (int index = 0; index < 8; index++) {
+        int prev = (index >> 2) & 0x01;
+        int cur = (index >> 1) & 0x01;
+        int next = index & 0x01;
+
+        printf("    {");
+        for (unsigned i = 0; i < samplesPerBit; i++) {
+            // Position in the bit, from 0 to 1, and
+            // the level we are coming from or going to
+            double t = (i + 0.5) / samplesPerBit;
+            int other = (t < 0.5) ? prev : next;
+            double distance = (t < 0.5) ? t : 1.0 - t;
+            double weight = 0.5 - 0.5 * cos(M_PI * (distance + 0.5));
+            double level = cur * weight + other * (1.0 - weight);
+            int nibble = (int)floor(1.0 + 13.0 * level + 0.5);
+            printf(" 0x%02X%s", nibble << 4, (i + 1 < samplesPerBit) ? "," : " ");
+        }
+        printf("},     // %d%d%d\n", prev, cur, next);
+    }
+    printf("};\n\n");
+}
+#endif
+
+int main(void) {
+    printf("// This file is generated by tools/profile_table.c, do not edit!\n\n");
+    printf("#include \"hardware/AFSK.h\"\n\n");
+    printf("#if AFSK_PROFILES != %u || SAMPLERATE != %lu\n", (unsigned)PROFILES, (unsigned long)SAMPLERATE);
+    printf("    #error Profile table does not match the modem configuration!\n");
+    printf("#endif\n\n");
+    #if MODULATION == MODULATION_AFSK
+        printf("#if AFSK_FILTER_FRAC != %d || AFSK_BAND_SHIFT != %d || AFSK_PRODUCT_SHIFT != %d\n",
+               AFSK_FILTER_FRAC, AFSK_BAND_SHIFT, AFSK_PRODUCT_SHIFT);
+        printf("    #error Profile table does not match the filter scaling!\n");
+        printf("#endif\n\n");
+    #endif
+
+    unsigned maxSamplesPerBit = 0;
+    for (unsigned i = 0; i < PROFILES; i++) {
+        unsigned bitrate = profiles[i].bitrate;
+        if (SAMPLERATE % bitrate != 0) fail("sample rate is not a multiple of the bitrate", bitrate);
+        unsigned samplesPerBit = SAMPLERATE / bitrate;
+        if (samplesPerBit * profiles[i].phaseBits > 127) fail("phase counter too large", bitrate);
+        if (samplesPerBit > maxSamplesPerBit) maxSamplesPerBit = samplesPerBit;
+
+        #if MODULATION == MODULATION_G3RUH
+            printShape(bitrate, samplesPerBit);
+        #endif
+    }
+
+    printf("#if AFSK_MAX_SAMPLESPERBIT < %u\n", maxSamplesPerBit);
+    printf("    #error AFSK_MAX_SAMPLESPERBIT is too small for the profiles!\n");
+    printf("#endif\n\n");
+
+    printf("const AfskProfile afskProfiles[AFSK_PROFILES] PROGMEM = {\n");
+    for (unsigned i = 0; i < PROFILES; i++) {
+        const ProfileDesign *p = &profiles[i];
+        unsigned samplesPerBit = SAMPLERATE / p->bitrate;
+
+        #if MODULATION == MODULATION_G3RUH
+            printf("    { %u, %u, %u, &g3ruhShape%u[0][0] },\n",
+                   p->bitrate, samplesPerBit, p->phaseBits, p->bitrate);
+        #else
+            if (p->lowpassCutoff * 2 >= SAMPLERATE) fail("low-pass cutoff above the Nyquist frequency", p->bitrate);
+            if (p->space * 2 >= SAMPLERATE) fail("space tone above the Nyquist frequency", p->bitrate);
+
+            Biquad band = bandpass(p->bitrate, p->mark, p->space, p->bandpassWidth);
+            Biquad low = lowpass(p->bitrate, p->lowpassCutoff);
+
+            printf("    // %u bps, %u/%uHz tones, %uHz low-pass", p->bitrate, p->mark, p->space, p->lowpassCutoff);
+            printf(band.b0 ? "\n" : ", no band-pass\n");
+            printf("    { %u, %u, %u, TONE_INC(%u), TONE_INC(%u), { %d, %d, %d }, { %d, %d, %d } },\n",
+                   p->bitrate, samplesPerBit, p->phaseBits, p->mark, p->space,
+                   band.b0, band.a1, band.a2, low.b0, low.a1, low.a2);
+        #endif
+    }
+    printf("};\n");
+
+    return 0;
+}
@@ -0,0 +1,139 @@
+// Host test for the G3RUH scrambler. It is built
+// and run by the Makefile, and fails the build if
+// the scrambler and descrambler in
+// hardware/G3RUH.h don't work together the way
+// the modem depends on:
+//
+// The scrambler gives the same line bits as a
+// plain shift register version of x^17 + x^12 + 1,
+// where every sent bit is the input XOR the bits
+// sent 12 and 17 bits earlier, as other G3RUH
+// modems expect.
+//
+// A frame sent through the NRZI encoder and the
+// scrambler comes out of the descrambler and the
+// NRZI decoder unchanged, once the descrambler
+// has seen 17 line bits, no matter what state it
+// started in, and also if the radio inverts the
+// signal.
+//
+// A wrong line bit gives exactly three wrong
+// descrambled bits, at the places the weak bit
+// tracking in AFSK_slice marks as weak.
+//
+// With a constant input, like a long run of ones,
+// the scrambler runs through all 2^17-1 states
+// before it repeats, so the line never stays
+// still for long.
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+#include "../hardware/G3RUH.h"
+
+#define BITS 4000
+#define ROUNDS 200
+#define SYNC_BITS (G3RUH_TAP_B + 1)
+
+static uint8_t data[BITS], line[BITS], levels[BITS];
+
+static int check_polynomial(int round) {
+    uint8_t sent[BITS];
+    uint32_t state = 0;
+    for (int i = 0; i < BITS; i++) {
+        uint8_t level = data[i];
+        uint8_t expect = level ^ (i >= 12 ? sent[i-12] : 0) ^ (i >= 17 ? sent[i-17] : 0);
+        sent[i] = g3ruh_scramble(&state, level);
+        if (sent[i] != expect) {
+            fprintf(stderr, "scrambler_test: round %d, bit %d doesn't follow x^17 + x^12 + 1\n", round, i);
+            return 1;
+        }
+    }
+    return 0;
+}
+
+// Sends the data bits the way the modem does:
+// a zero toggles the NRZI level, and the level
+// is then scrambled
+static void send(uint32_t state) {
+    uint8_t level = 0;
+    for (int i = 0; i < BITS; i++) {
+        level ^= !data[i];
+        line[i] = g3ruh_scramble(&state, level);
+    }
+}
+
+static void receive(uint32_t state, uint8_t invert) {
+    for (int i = 0; i < BITS; i++) {
+        levels[i] = g3ruh_descramble(&state, line[i] ^ invert);
+    }
+}
+
+static int check_roundtrip(int round, uint8_t invert) {
+    receive(rand(), invert);
+    for (int i = SYNC_BITS + 1; i < BITS; i++) {
+        uint8_t bit = levels[i] == levels[i-1];
+        if (bit != data[i]) {
+            fprintf(stderr, "scrambler_test: round %d%s, bit %d is wrong\n", round, invert ? " inverted" : "", i);
+            return 1;
+        }
+    }
+    return 0;
+}
+
+static int check_error(int round) {
+    uint8_t good[BITS];
+    uint32_t state = rand();
+    receive(state, 0);
+    for (int i = 0; i < BITS; i++) good[i] = levels[i];
+
+    int at = SYNC_BITS + rand() % (BITS - 2 * SYNC_BITS);
+    line[at] ^= 1;
+    receive(state, 0);
+    line[at] ^= 1;
+
+    for (int i = 0; i < BITS; i++) {
+        int wrong = i == at || i == at + G3RUH_TAP_A + 1 || i == at + G3RUH_TAP_B + 1;
+        if ((levels[i] != good[i]) != wrong) {
+            fprintf(stderr, "scrambler_test: round %d, a line error at bit %d %s bit %d\n",
+                    round, at, wrong ? "didn't change" : "changed", i);
+            return 1;
+        }
+    }
+    return 0;
+}
+
+static int check_period(void) {
+    uint32_t state = 1;
+    uint32_t start = 0;
+    long period = 0;
+    for (long i = 0; i < 2 * 131071L + SYNC_BITS; i++) {
+        g3ruh_scramble(&state, 1);
+        if (i == SYNC_BITS) start = state & 0x1FFFF;
+        if (i > SYNC_BITS && (state & 0x1FFFF) == start) {
+            period = i - SYNC_BITS;
+            break;
+        }
+    }
+    if (period != 131071L) {
+        fprintf(stderr, "scrambler_test: the scrambler repeats after %ld bits\n", period);
+        return 1;
+    }
+    return 0;
+}
+
+int main(void) {
+    srand(1);
+    for (int round = 0; round < ROUNDS; round++) {
+        for (int i = 0; i < BITS; i++) data[i] = rand() & 1;
+        if (check_polynomial(round)) return 1;
+        send(rand());
+
+        if (check_roundtrip(round, 0)) return 1;
+        if (check_roundtrip(round, 1)) return 1;
+        if (check_error(round)) return 1;
+    }
+
+    return check_period();
+}
@@ -0,0 +1,40 @@
+// Host tool that generates the sine table for the
+// AFSK tone generator. It is built and run by the
+// Makefile, and the output is written to
+// hardware/AFSK-sine.c
+//
+// The table holds one full period, so the DAC ISR
+// can look up a sample directly from the top bits
+// of the phase accumulator, without folding the
+// phase into a quarter period first.
+
+#include <stdio.h>
+#include <math.h>
+
+#define SIN_BITS 8
+#define SIN_LEN (1 << SIN_BITS)
+
+int main(void) {
+    printf("// This file is generated by tools/sine_table.c, do not edit!\n\n");
+    printf("#include \"hardware/AFSK.h\"\n\n");
+    printf("#if SIN_LEN != %d\n", SIN_LEN);
+    printf("    #error Sine table does not match SIN_LEN!\n");
+    printf("#endif\n\n");
+    printf("const uint8_t sin_table[SIN_LEN] PROGMEM = {\n");
+
+    for (int i = 0; i < SIN_LEN; i++) {
+        // Sample in the middle of each step, so the
+        // table is symmetric around 127.5
+        double phase = 2.0 * M_PI * (i + 0.5) / SIN_LEN;
+        int sample = (int)floor(127.5 + 127.5 * sin(phase) + 0.5);
+        if (sample > 255) sample = 255;
+        if (sample < 0) sample = 0;
+
+        if (i % 16 == 0) printf("    ");
+        printf("%3d,", sample);
+        printf((i % 16 == 15) ? "\n" : " ");
+    }
+
+    printf("};\n");
+    return 0;
+}
@@ -0,0 +1,265 @@
+// Host test for receiving with several slicers.
+// It is built with three slicers and five LLP
+// slots, which the 328p has no RAM for, and run
+// by the Makefile, which fails the build if a
+// frame that the slicers decode more than once
+// reaches the host more than once, or if a frame
+// that was never closed properly gets through.
+//
+// Every slicer gets its own stream of deframed
+// bits, which go through the real HDLC deframer
+// and LLP decoder. The frame is encoded by the
+// firmware's own LLP code, and the streams are
+// built from it, so the slicers can be made to
+// disagree in ways that audio can't be made to
+// do on purpose:
+//
+// All slicers decode the frame. It must reach
+// the host once.
+//
+// The other slicers miss the closing flag, which
+// they see as an abort, and only find a flag
+// again in the preamble of the next transmission.
+// The frame must still reach the host only once.
+//
+// A slicer picks up a few bytes of noise after
+// the frame before it finds a flag. The frame
+// has bytes after its last whole block, and
+// must not reach the host.
+//
+// The same frame is sent twice, a second apart.
+// It must reach the host twice.
+//
+// The deframer and slicer state are static, so
+// the test includes hardware/AFSK.c itself, like
+// tools/hdlc_test.c does.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "hardware/AFSK.c"
+#include "protocol/LLP.h"
+
+#if CONFIG_AFSK_SLICERS < 3 || CONFIG_LLP_RX_SLOTS < CONFIG_AFSK_SLICERS + 2
+    #error The slicer test must be built with three slicers and five LLP slots
+#endif
+
+#define FRAME_LEN 100
+#define STREAM_BYTES 4096                   // Over a second at 9600 bps
+#define PREAMBLE_FLAGS 24
+#define GAP_MS 130                          // Silence between two transmissions
+#define REPEAT_MS 1000                      // Time between two sends of the same frame
+
+volatile uint8_t PORTB, DDRB, PORTC, DDRC, PORTD, DDRD;
+volatile uint8_t TCCR1A, TCCR1B, TIFR1;
+volatile uint8_t ADMUX, ADCSRA, ADCSRB, DIDR0;
+volatile uint16_t ICR1, ADC;
+
+unsigned long custom_preamble = 300;
+unsigned long custom_tail = 30;
+
+typedef struct Stream {
+    uint8_t bits[STREAM_BYTES];
+    size_t count;
+    int ones;
+} Stream;
+
+static Afsk modem;
+static LLPCtx llp;
+static LLPAddress address = { 0xFFFF, 0xFFFF };
+
+static uint8_t payload[FRAME_LEN];
+static uint8_t frame[2 * LLP_MAX_FRAME_LENGTH];
+static size_t frameLen;
+static Stream streams[CONFIG_AFSK_SLICERS];
+static int delivered, bad;
+
+static void frameReceived(LLPCtx *ctx, const LLPMsg *unused) {
+    const LLPMsg *msg;
+    while ((msg = llp_rxFrame(ctx)) != NULL) {
+        if (msg->len == FRAME_LEN && !memcmp(msg->data, payload, FRAME_LEN)) {
+            delivered++;
+        } else {
+            bad++;
+        }
+        llp_rxRelease(ctx);
+    }
+}
+
+// Moves whatever the LLP encoder has written to
+// the TX FIFO of the sink into the frame
+static void drain(Afsk *sink) {
+    while (!fifo_isempty(&sink->txFifo)) frame[frameLen++] = fifo_pop(&sink->txFifo);
+}
+
+// Encodes the frame the way the modem would get
+// it in its TX FIFO, where LLP_ESC marks a byte
+// that is sent as data even if it looks like a
+// flag
+static void encodeFrame(void) {
+    static Afsk sink;
+    static LLPCtx ctx;
+    AFSK_init(&sink);
+    llp_init(&ctx, &address, &sink, NULL);
+
+    for (int i = 0; i < FRAME_LEN; i++) payload[i] = rand();
+
+    uint8_t header[LLP_MAX_HEADER_LENGTH];
+    size_t headerLen = llp_broadcastStart(&ctx, FRAME_LEN, header);
+    drain(&sink);
+    for (size_t i = 0; i < headerLen; i += LLP_SEND_CHUNK) {
+        llp_sendData(&ctx, &header[i], headerLen - i < LLP_SEND_CHUNK ? headerLen - i : LLP_SEND_CHUNK);
+        drain(&sink);
+    }
+    for (size_t i = 0; i < FRAME_LEN; i += LLP_SEND_CHUNK) {
+        llp_sendData(&ctx, &payload[i], FRAME_LEN - i < LLP_SEND_CHUNK ? FRAME_LEN - i : LLP_SEND_CHUNK);
+        drain(&sink);
+    }
+    llp_sendEnd(&ctx);
+    drain(&sink);
+    AFSK_DAC_IRQ_STOP();
+}
+
+static void putBit(Stream *s, bool bit) {
+    if (s->count >= 8 * STREAM_BYTES) {
+        fprintf(stderr, "slicers_test: STREAM_BYTES is too small\n");
+        exit(1);
+    }
+    if (bit) s->bits[s->count / 8] |= 1 << (s->count % 8);
+    s->count++;
+}
+
+// Puts a byte in the stream LSB first, with a
+// zero stuffed in after five ones unless it is a
+// flag or an abort
+static void putByte(Stream *s, uint8_t byte, bool stuff) {
+    for (int i = 0; i < 8; i++) {
+        bool bit = (byte >> i) & 0x01;
+        putBit(s, bit);
+        s->ones = bit ? s->ones + 1 : 0;
+        if (stuff && s->ones == 5) {
+            putBit(s, false);
+            s->ones = 0;
+        }
+    }
+    if (!stuff) s->ones = 0;
+}
+
+static void putFlags(Stream *s, int n) {
+    for (int i = 0; i < n; i++) putByte(s, HDLC_FLAG, false);
+}
+
+// The frame itself, without the flags around it
+static void putFrame(Stream *s) {
+    for (size_t i = 0; i < frameLen; i++) {
+        uint8_t c = frame[i];
+        if (c == HDLC_FLAG) continue;
+        if (c == LLP_ESC) {
+            putByte(s, frame[++i], true);
+        } else {
+            putByte(s, c, c != HDLC_RESET);
+        }
+    }
+}
+
+// Silence comes out of the demodulator as ones,
+// which the deframer sees as an abort
+static void putSilence(Stream *s, int ms) {
+    long bits = (long)ms * modem.profile.bitrate / 1000;
+    for (long i = 0; i < bits; i++) putBit(s, true);
+}
+
+static void putTransmission(Stream *s) {
+    putFlags(s, PREAMBLE_FLAGS);
+    putFrame(s);
+    putFlags(s, 3);
+}
+
+static void reset(void) {
+    memset(streams, 0, sizeof(streams));
+}
+
+// Feeds the streams to the deframers of the
+// slicers a byte at a time, with the clock going
+// on as it would, and returns how many times the
+// frame reached the host
+static int run(void) {
+    AFSK_init(&modem);
+    llp_init(&llp, &address, &modem, frameReceived);
+    _clock = 0;
+    delivered = bad = 0;
+
+    size_t bytes = 0;
+    for (int i = 0; i < CONFIG_AFSK_SLICERS; i++) {
+        putSilence(&streams[i], 100);
+        if (streams[i].count > bytes * 8) bytes = (streams[i].count + 7) / 8;
+    }
+
+    for (size_t i = 0; i < bytes; i++) {
+        for (int s = 0; s < CONFIG_AFSK_SLICERS; s++) {
+            AfskSlicer *slicer = &modem.slicers[s];
+            uint8_t bits = i * 8 < streams[s].count ? streams[s].bits[i] : 0xFF;
+            hdlcParse(&slicer->hdlc, bits, 0, &slicer->rxFifo);
+        }
+        _clock += 8 * modem.profile.samplesPerBit;
+        llp_poll(&llp);
+    }
+
+    return bad ? -1 : delivered;
+}
+
+static int check(const char *what, int expected) {
+    int got = run();
+    if (got != expected) {
+        fprintf(stderr, "slicers_test: %s: the frame reached the host %d times, not %d%s\n",
+                what, delivered, expected, bad ? ", and a bad frame did too" : "");
+        return 1;
+    }
+    return 0;
+}
+
+int main(void) {
+    srand(1);
+    AFSK_init(&modem);
+    encodeFrame();
+
+    int failed = 0;
+
+    reset();
+    for (int i = 0; i < CONFIG_AFSK_SLICERS; i++) {
+        putSilence(&streams[i], i);
+        putTransmission(&streams[i]);
+    }
+    failed |= check("all slicers decode the frame", 1);
+
+    reset();
+    putTransmission(&streams[0]);
+    putSilence(&streams[0], GAP_MS);
+    putFlags(&streams[0], PREAMBLE_FLAGS);
+    for (int i = 1; i < CONFIG_AFSK_SLICERS; i++) {
+        putFlags(&streams[i], PREAMBLE_FLAGS);
+        putFrame(&streams[i]);
+        putByte(&streams[i], 0xFF, false);
+        putSilence(&streams[i], GAP_MS);
+        putFlags(&streams[i], PREAMBLE_FLAGS);
+    }
+    failed |= check("slicers miss the closing flag", 1);
+
+    reset();
+    putFlags(&streams[1], PREAMBLE_FLAGS);
+    putFrame(&streams[1]);
+    for (int i = 0; i < 5; i++) putByte(&streams[1], rand(), true);
+    putFlags(&streams[1], 3);
+    failed |= check("noise after the frame", 0);
+
+    reset();
+    for (int i = 0; i < CONFIG_AFSK_SLICERS; i++) {
+        putTransmission(&streams[i]);
+        putSilence(&streams[i], REPEAT_MS);
+        putTransmission(&streams[i]);
+    }
+    failed |= check("the frame is sent twice", 2);
+
+    return failed;
+}
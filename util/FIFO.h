@@ -2,84 +2,146 @@
 #define UTIL_FIFO_H
 
 #include <stddef.h>
-#include <util/atomic.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+
+// This is a single-producer/single-consumer ring
+// buffer. The producer only ever writes the tail
+// index and the consumer only ever writes the
+// head index. Since both indexes are 8 bits, they
+// are read and written atomically on the AVR, so
+// one side can live in an ISR and the other in
+// the main loop without ever disabling interrupts.
+//
+// The indexes are free-running and wrap around
+// at 256, so the number of bytes in the buffer is
+// simply tail - head. For this to work the buffer
+// size must be a power of two, no larger than 128.
+
+#define FIFO_MAX_SIZE 128
+#define FIFO_SIZE_VALID(size) ((size) > 0 && (size) <= FIFO_MAX_SIZE && ((size) & ((size) - 1)) == 0)
+
+// Keeps the compiler from moving buffer accesses
+// across the index updates that publish them
+#define FIFO_BARRIER() __asm__ __volatile__ ("" ::: "memory")
 
 typedef struct FIFOBuffer
 {
-  unsigned char *begin;
-  unsigned char *end;
-  unsigned char * volatile head;
-  unsigned char * volatile tail;
+  uint8_t *buffer;
+  uint8_t mask;
+  volatile uint8_t head;
+  volatile uint8_t tail;
 } FIFOBuffer;
 
-inline bool fifo_isempty(const FIFOBuffer *f) {
-  return f->head == f->tail;
+static inline void fifo_init(FIFOBuffer *f, uint8_t *buffer, size_t size) {
+  f->buffer = buffer;
+  f->mask = size - 1;
+  f->head = f->tail = 0;
 }
 
-inline bool fifo_isfull(const FIFOBuffer *f) {
-  return ((f->head == f->begin) && (f->tail == f->end)) || (f->tail == f->head - 1);
+static inline uint8_t fifo_count(const FIFOBuffer *f) {
+  return (uint8_t)(f->tail - f->head);
 }
 
-inline void fifo_push(FIFOBuffer *f, unsigned char c) {
-  *(f->tail) = c;
-  
-  if (f->tail == f->end) {
-    f->tail = f->begin;
-  } else {
-    f->tail++;
-  }
+static inline uint8_t fifo_space(const FIFOBuffer *f) {
+  return (uint8_t)(f->mask + 1 - fifo_count(f));
 }
 
-inline unsigned char fifo_pop(FIFOBuffer *f) {
-  if(f->head == f->end) {
-    f->head = f->begin;
-    return *(f->end);
-  } else {
-    return *(f->head++);
-  }
+static inline size_t fifo_len(const FIFOBuffer *f) {
+  return f->mask + 1;
 }
 
-inline void fifo_flush(FIFOBuffer *f) {
-  f->head = f->tail;
+static inline bool fifo_isempty(const FIFOBuffer *f) {
+  return f->head == f->tail;
 }
 
-inline bool fifo_isempty_locked(const FIFOBuffer *f) {
-  bool result;
-  ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
-    result = fifo_isempty(f);
-  }
-  return result;
+static inline bool fifo_isfull(const FIFOBuffer *f) {
+  return fifo_count(f) > f->mask;
 }
 
-inline bool fifo_isfull_locked(const FIFOBuffer *f) {
-  bool result;
-  ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
-    result = fifo_isfull(f);
-  }
-  return result;
+// Producer side. The caller must check that
+// the buffer is not full before pushing.
+static inline void fifo_push(FIFOBuffer *f, uint8_t c) {
+  uint8_t tail = f->tail;
+  f->buffer[tail & f->mask] = c;
+  FIFO_BARRIER();
+  f->tail = tail + 1;
 }
 
-inline void fifo_push_locked(FIFOBuffer *f, unsigned char c) {
-  ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
-    fifo_push(f, c);
-  }
+// Consumer side. The caller must check that
+// the buffer is not empty before popping.
+static inline uint8_t fifo_pop(FIFOBuffer *f) {
+  uint8_t head = f->head;
+  uint8_t c = f->buffer[head & f->mask];
+  FIFO_BARRIER();
+  f->head = head + 1;
+  return c;
 }
 
-inline unsigned char fifo_pop_locked(FIFOBuffer *f) {
-  unsigned char c;
-  ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
-    c = fifo_pop(f);
-  }
-  return c;
+// Consumer side. Discards everything that is
+// currently in the buffer.
+static inline void fifo_flush(FIFOBuffer *f) {
+  f->head = f->tail;
+}
+
+// Producer side. Pushes as many of the n bytes
+// as there is room for, and returns how many
+// that was. The tail is only published once,
+// after all bytes have been copied.
+static inline uint8_t fifo_push_n(FIFOBuffer *f, const uint8_t *data, uint8_t n) {
+  uint8_t space = fifo_space(f);
+  if (n > space) n = space;
+
+  uint8_t tail = f->tail;
+  uint8_t index = tail & f->mask;
+  uint8_t first = f->mask + 1 - index;
+  if (first > n) first = n;
+
+  memcpy(&f->buffer[index], data, first);
+  memcpy(f->buffer, data + first, n - first);
+  FIFO_BARRIER();
+  f->tail = tail + n;
+
+  return n;
+}
+
+// Consumer side. Pops up to n bytes into data
+// and returns how many were actually popped.
+static inline uint8_t fifo_pop_n(FIFOBuffer *f, uint8_t *data, uint8_t n) {
+  uint8_t count = fifo_count(f);
+  if (n > count) n = count;
+
+  uint8_t head = f->head;
+  uint8_t index = head & f->mask;
+  uint8_t first = f->mask + 1 - index;
+  if (first > n) first = n;
+
+  memcpy(data, &f->buffer[index], first);
+  memcpy(data + first, f->buffer, n - first);
+  FIFO_BARRIER();
+  f->head = head + n;
+
+  return n;
 }
 
-inline void fifo_init(FIFOBuffer *f, unsigned char *buffer, size_t size) {
-  f->head = f->tail = f->begin = buffer;
-  f->end = buffer + size -1;
+// Consumer side. Returns the number of bytes that
+// can be read in one go, without wrapping around,
+// and points *span at the first of them. The bytes
+// stay in the buffer until fifo_skip is called, so
+// they can be processed in place.
+static inline uint8_t fifo_readspan(const FIFOBuffer *f, const uint8_t **span) {
+  uint8_t count = fifo_count(f);
+  uint8_t index = f->head & f->mask;
+  uint8_t first = f->mask + 1 - index;
+
+  *span = &f->buffer[index];
+  return (count < first) ? count : first;
 }
 
-inline size_t fifo_len(FIFOBuffer *f) {
-  return f->end - f->begin;
+static inline void fifo_skip(FIFOBuffer *f, uint8_t n) {
+  FIFO_BARRIER();
+  f->head += n;
 }
 
-#endif
\ No newline at end of file
+#endif
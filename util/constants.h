@@ -9,4 +9,11 @@
 #define REF_5V  0x02
 
 #define SERIAL_FRAMING_KISS 0x01
-#define SERIAL_FRAMING_DIRECT 0x02
\ No newline at end of file
+#define SERIAL_FRAMING_DIRECT 0x02
+#define SERIAL_FRAMING_BINARY 0x03
+
+#define AFSK_DEMOD_DISCRIMINATOR 0x01
+#define AFSK_DEMOD_CORRELATOR 0x02
+
+#define MODULATION_AFSK 0x01
+#define MODULATION_G3RUH 0x02
\ No newline at end of file
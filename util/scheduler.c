@@ -0,0 +1,70 @@
+#include "scheduler.h"
+
+#define TASK_READY     0x00
+#define TASK_SLEEPING  0x01
+#define TASK_SUSPENDED 0x02
+
+typedef struct Task {
+    task_fn_t fn;               // Function to run
+    ticks_t wake;               // When a sleeping task should run again
+    uint8_t state;              // Ready, sleeping or suspended
+} Task;
+
+static Task tasks[CONFIG_SCHED_TASKS];
+static uint8_t taskCount;
+static task_t current = TASK_NONE;
+
+// Registers a task. Tasks are run in the order
+// they were added, and start out ready.
+task_t sched_add(task_fn_t fn) {
+    if (taskCount >= CONFIG_SCHED_TASKS) return TASK_NONE;
+    tasks[taskCount].fn = fn;
+    tasks[taskCount].state = TASK_READY;
+    return taskCount++;
+}
+
+// Called from within a task, to not be run again
+// until the given number of ticks have passed.
+void sched_sleep(ticks_t ticks) {
+    if (current == TASK_NONE) return;
+    tasks[current].wake = timer_clock() + ticks;
+    tasks[current].state = TASK_SLEEPING;
+}
+
+// Called from within a task, to not be run again
+// until someone calls sched_wake on it.
+void sched_suspend(void) {
+    if (current == TASK_NONE) return;
+    tasks[current].state = TASK_SUSPENDED;
+}
+
+// Makes a suspended task ready again. Sleeping
+// tasks are left alone, so that waking a task
+// can never cut a timed wait short.
+void sched_wake(task_t task) {
+    if (task < taskCount && tasks[task].state == TASK_SUSPENDED) {
+        tasks[task].state = TASK_READY;
+    }
+}
+
+// Runs every task that is ready once
+void sched_poll(void) {
+    ticks_t now = timer_clock();
+    for (task_t i = 0; i < taskCount; i++) {
+        Task *task = &tasks[i];
+        if (task->state == TASK_SLEEPING && now - task->wake >= 0) {
+            task->state = TASK_READY;
+        }
+        if (task->state == TASK_READY) {
+            current = i;
+            task->fn();
+            current = TASK_NONE;
+        }
+    }
+}
+
+void sched_run(void) {
+    while (true) {
+        sched_poll();
+    }
+}
@@ -0,0 +1,39 @@
+#ifndef UTIL_SCHEDULER_H
+#define UTIL_SCHEDULER_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "time.h"
+
+// This is a tiny cooperative scheduler. Each task
+// is a function that does a bit of work and then
+// returns, and the main loop just keeps running
+// whichever tasks are ready. A task that has
+// nothing to do for a while can put itself to
+// sleep for a number of ticks, or suspend itself
+// until some other part of the firmware wakes it
+// up again. That way nothing ever spins waiting
+// for something to happen, and receiving, serial
+// I/O and channel access all progress together.
+
+// The most tasks that can be added. init() and
+// kiss_init add six, so there is room for two
+// more. sched_add returns TASK_NONE when the
+// table is full, and init() halts the modem with
+// both LEDs lit if that ever happens, rather than
+// running without a task that is needed.
+#define CONFIG_SCHED_TASKS 8
+
+typedef void (*task_fn_t)(void);
+typedef uint8_t task_t;
+
+#define TASK_NONE 0xFF
+
+task_t sched_add(task_fn_t fn);
+void sched_sleep(ticks_t ticks);
+void sched_suspend(void);
+void sched_wake(task_t task);
+void sched_poll(void);
+void sched_run(void) __attribute__((noreturn));
+
+#endif
@@ -23,20 +23,12 @@ inline ticks_t timer_clock(void) {
 }
 
 
+// The sample rate isn't always a whole number of
+// ticks per millisecond (38400 Hz in G3RUH mode),
+// so the conversion is done in 32 bits, which
+// is exact for up to about 55 seconds.
 inline ticks_t ms_to_ticks(mtime_t ms) {
-    return ms * DIV_ROUND(CLOCK_TICKS_PER_SEC, 1000);
-}
-
-inline void cpu_relax(void) {
-    // Do nothing!
-}
-
-inline void delay_ms(unsigned long ms) {
-    ticks_t start = timer_clock();
-    unsigned long n_ticks = ms_to_ticks(ms);
-    while (timer_clock() - start < n_ticks) {
-        cpu_relax();
-    }
+    return DIV_ROUND(ms * (ticks_t)CLOCK_TICKS_PER_SEC, 1000);
 }
 
 